@@ -509,6 +509,7 @@ const struct prefs vars[] =
 	{"irc_id_ytext", P_OFFSET (hex_irc_id_ytext), TYPE_STR},
 	{"irc_invisible", P_OFFINT (hex_irc_invisible), TYPE_BOOL},
 	{"irc_join_delay", P_OFFINT (hex_irc_join_delay), TYPE_INT},
+	{"irc_log_sync", P_OFFINT (hex_irc_log_sync), TYPE_INT},
 	{"irc_logging", P_OFFINT (hex_irc_logging), TYPE_BOOL},
 	{"irc_logmask", P_OFFSET (hex_irc_logmask), TYPE_STR},
 	{"irc_nick1", P_OFFSET (hex_irc_nick1), TYPE_STR},
@@ -541,8 +542,12 @@ const struct prefs vars[] =
 	{"net_proxy_type", P_OFFINT (hex_net_proxy_type), TYPE_INT},
 	{"net_proxy_use", P_OFFINT (hex_net_proxy_use), TYPE_INT},
 	{"net_proxy_user", P_OFFSET (hex_net_proxy_user), TYPE_STR},
+	{"net_read_lines", P_OFFINT (hex_net_read_lines), TYPE_INT},
 	{"net_reconnect_delay", P_OFFINT (hex_net_reconnect_delay), TYPE_INT},
+	{"net_recv_buffer", P_OFFINT (hex_net_recv_buffer), TYPE_INT},
 	{"net_throttle", P_OFFINT (hex_net_throttle), TYPE_BOOL},
+	{"net_throttle_burst", P_OFFINT (hex_net_throttle_burst), TYPE_INT},
+	{"net_throttle_delay", P_OFFINT (hex_net_throttle_delay), TYPE_INT},
 
 	{"notify_timeout", P_OFFINT (hex_notify_timeout), TYPE_INT},
 	{"notify_whois_online", P_OFFINT (hex_notify_whois_online), TYPE_BOOL},
@@ -832,7 +837,11 @@ load_default_config(void)
 	prefs.hex_irc_ban_type = 1;
 	prefs.hex_irc_join_delay = 5;
 	prefs.hex_net_ping_timeout = 60;
+	prefs.hex_net_read_lines = 500;
 	prefs.hex_net_reconnect_delay = 10;
+	prefs.hex_net_recv_buffer = 64;
+	prefs.hex_net_throttle_burst = 5;
+	prefs.hex_net_throttle_delay = 2000;
 	prefs.hex_notify_timeout = 15;
 	prefs.hex_text_max_indent = 256;
 	prefs.hex_text_max_lines = 5000;
@@ -97,12 +97,17 @@ void fe_progressbar_start (struct session *sess);
 void fe_progressbar_end (struct server *serv);
 void fe_print_text (struct session *sess, char *text, time_t stamp,
 					gboolean no_activity);
+/* scrollback replay is starting for sess: how many of the newest lines
+   to replay, 0 for all of them if fe_prepend_text can't page in the rest */
+int fe_replay_start (struct session *sess);
+void fe_prepend_text (struct session *sess, char *text, time_t stamp);
 void fe_userlist_insert (struct session *sess, struct User *newuser, gboolean sel);
 int fe_userlist_remove (struct session *sess, struct User *user);
 void fe_userlist_rehash (struct session *sess, struct User *user);
 void fe_userlist_update (struct session *sess, struct User *user);
 void fe_userlist_numbers (struct session *sess);
 void fe_userlist_clear (struct session *sess);
+void fe_userlist_reload (struct session *sess);
 void fe_userlist_set_selected (struct session *sess);
 void fe_uselect (session *sess, char *word[], int do_clear, int scroll_to);
 void fe_dcc_add (struct DCC *dcc);
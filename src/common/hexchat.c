@@ -60,6 +60,7 @@ GSList *command_list = 0;
 GSList *ctcp_list = 0;
 GSList *replace_list = 0;
 GSList *sess_list = 0;
+static GHashTable *sess_live = NULL;	/* the same sessions, for is_session */
 GSList *dcc_list = 0;
 GSList *ignore_list = 0;
 GSList *usermenu_list = 0;
@@ -81,7 +82,7 @@ GSList *tabmenu_list = 0;
  * beginning of one of the lists.  The aim is to be able to switch to the
  * session with the most important/recent activity.
  */
-GList *sess_list_by_lastact[5] = {NULL, NULL, NULL, NULL, NULL};
+session *sess_list_by_lastact[5] = {NULL, NULL, NULL, NULL, NULL};
 
 
 static int in_hexchat_exit = FALSE;
@@ -96,6 +97,36 @@ struct session *current_tab;
 struct session *current_sess = 0;
 struct hexchatprefs prefs;
 
+/* The lists are linked through the sessions themselves, so moving a
+   session around never has to search for it. */
+static void
+lastact_unlink (session *sess)
+{
+	if (sess->lastact_idx == LACT_NONE)
+		return;
+
+	if (sess->lastact_prev)
+		sess->lastact_prev->lastact_next = sess->lastact_next;
+	else
+		sess_list_by_lastact[sess->lastact_idx] = sess->lastact_next;
+	if (sess->lastact_next)
+		sess->lastact_next->lastact_prev = sess->lastact_prev;
+
+	sess->lastact_prev = sess->lastact_next = NULL;
+	sess->lastact_idx = LACT_NONE;
+}
+
+static void
+lastact_prepend (session *sess, int idx)
+{
+	sess->lastact_idx = idx;
+	sess->lastact_prev = NULL;
+	sess->lastact_next = sess_list_by_lastact[idx];
+	if (sess->lastact_next)
+		sess->lastact_next->lastact_prev = sess;
+	sess_list_by_lastact[idx] = sess;
+}
+
 /*
  * Update the priority queue of the "interesting sessions"
  * (sess_list_by_lastact).
@@ -116,18 +147,15 @@ lastact_update(session *sess)
 
 	/* If already first at the right position, just return */
 	if (oldidx == newidx &&
-		 (newidx == LACT_NONE || g_list_index(sess_list_by_lastact[newidx], sess) == 0))
+		 (newidx == LACT_NONE || sess_list_by_lastact[newidx] == sess))
 		return;
 
 	/* Remove from the old position */
-	if (oldidx != LACT_NONE)
-		sess_list_by_lastact[oldidx] = g_list_remove(sess_list_by_lastact[oldidx], sess);
+	lastact_unlink (sess);
 
 	/* Add at the new position */
-	sess->lastact_idx = newidx;
 	if (newidx != LACT_NONE)
-		sess_list_by_lastact[newidx] = g_list_prepend(sess_list_by_lastact[newidx], sess);
-	return;
+		lastact_prepend (sess, newidx);
 }
 
 /*
@@ -142,74 +170,127 @@ session *
 lastact_getfirst(int (*filter) (session *sess))
 {
 	int i;
-	session *sess = NULL;
-	GList *curitem;
+	session *sess;
 
 	/* 5 is the number of priority classes LACT_ */
-	for (i = 0; i < 5 && !sess; i++)
+	for (i = 0; i < 5; i++)
 	{
-		curitem = sess_list_by_lastact[i];
-		while (curitem && !sess)
+		for (sess = sess_list_by_lastact[i]; sess; sess = sess->lastact_next)
 		{
-			sess = g_list_nth_data(curitem, 0);
-			if (!sess || (filter && !filter(sess)))
+			if (!filter || filter (sess))
 			{
-				sess = NULL;
-				curitem = g_list_next(curitem);
+				lastact_unlink (sess);
+				return sess;
 			}
 		}
-
-		if (sess)
-		{
-			sess_list_by_lastact[i] = g_list_remove(sess_list_by_lastact[i], sess);
-			sess->lastact_idx = LACT_NONE;
-		}
 	}
-	
-	return sess;
+
+	return NULL;
 }
 
 int
 is_session (session * sess)
 {
-	return g_slist_find (sess_list, sess) ? 1 : 0;
+	return sess && sess_live && g_hash_table_lookup (sess_live, sess) ? 1 : 0;
 }
 
-session *
-find_dialog (server *serv, char *nick)
+/* channel and dialog tabs are indexed per server by their casefolded
+   name, so finding the tab for a message doesn't walk sess_list */
+
+static GHashTable *
+session_index_table (session *sess)
 {
-	GSList *list = sess_list;
-	session *sess;
+	switch (sess->type)
+	{
+	case SESS_CHANNEL:
+		return sess->server->chan_index;
+	case SESS_DIALOG:
+		return sess->server->dialog_index;
+	}
+	return NULL;
+}
 
-	while (list)
+/* key must hold CHANLEN bytes; names that can't fit sess->channel
+   can't match any tab */
+static gboolean
+session_index_key (server *serv, char *key, const char *name)
+{
+	return casefold_key (serv->casemapping, key, name, CHANLEN);
+}
+
+void
+session_index_add (session *sess)
+{
+	GHashTable *index = session_index_table (sess);
+	char key[CHANLEN];
+
+	if (index && sess->channel[0] && session_index_key (sess->server, key, sess->channel))
+		g_hash_table_insert (index, g_strdup (key), sess);
+}
+
+/* call before sess->channel changes or the session goes away */
+void
+session_index_remove (session *sess)
+{
+	GHashTable *index = session_index_table (sess);
+	char key[CHANLEN];
+	GSList *list;
+	session *s;
+
+	if (!index || !sess->channel[0] || !session_index_key (sess->server, key, sess->channel))
+		return;
+	if (g_hash_table_lookup (index, key) != sess)
+		return;
+	g_hash_table_remove (index, key);
+
+	/* another tab with the same name takes its place */
+	for (list = sess_list; list; list = list->next)
 	{
-		sess = list->data;
-		if (sess->server == serv && sess->type == SESS_DIALOG)
+		s = list->data;
+		if (s != sess && s->server == sess->server && s->type == sess->type &&
+			 !sess->server->p_cmp (s->channel, sess->channel))
 		{
-			if (!serv->p_cmp (nick, sess->channel))
-				return (sess);
+			g_hash_table_insert (index, g_strdup (key), s);
+			break;
 		}
-		list = list->next;
 	}
-	return NULL;
 }
 
-session *
-find_channel (server *serv, char *chan)
+/* serv->casemapping changed, so every key may be stale */
+void
+session_index_rebuild (server *serv)
 {
+	GSList *list;
 	session *sess;
-	GSList *list = sess_list;
-	while (list)
+
+	g_hash_table_remove_all (serv->chan_index);
+	g_hash_table_remove_all (serv->dialog_index);
+	for (list = sess_list; list; list = list->next)
 	{
 		sess = list->data;
-		if ((serv == sess->server) && sess->type == SESS_CHANNEL)
-		{
-			if (!serv->p_cmp (chan, sess->channel))
-				return sess;
-		}
-		list = list->next;
+		if (sess->server == serv)
+			session_index_add (sess);
 	}
-	return NULL;
+}
+
+session *
+find_dialog (server *serv, char *nick)
+{
+	char key[CHANLEN];
+
+	if (!session_index_key (serv, key, nick))
+		return NULL;
+	return g_hash_table_lookup (serv->dialog_index, key);
+}
+
+session *
+find_channel (server *serv, char *chan)
+{
+	char key[CHANLEN];
+
+	if (!session_index_key (serv, key, chan))
+		return NULL;
+	return g_hash_table_lookup (serv->chan_index, key);
 }
 
 static void
@@ -459,7 +540,6 @@ session_new (server *serv, char *from, int type, int focus)
 	sess = g_new0 (struct session, 1);
 
 	sess->server = serv;
-	sess->logfd = -1;
 	sess->type = type;
 
 	sess->alert_balloon = SET_DEFAULT;
@@ -481,6 +561,10 @@ session_new (server *serv, char *from, int type, int focus)
 	}
 
 	sess_list = g_slist_prepend (sess_list, sess);
+	if (!sess_live)
+		sess_live = g_hash_table_new (g_direct_hash, g_direct_equal);
+	g_hash_table_insert (sess_live, sess, sess);
+	session_index_add (sess);
 
 	fe_new_window (sess, focus);
 
@@ -526,8 +610,8 @@ new_ircwindow (server *serv, char *name, int type, int focus)
 		log_open_or_close (sess);
 
 		user = userlist_find_global (serv, name);
-		if (user && user->hostname)
-			set_topic (sess, user->hostname, user->hostname);
+		if (user && user->person->hostname)
+			set_topic (sess, user->person->hostname, user->person->hostname);
 	}
 	return sess;
 }
@@ -602,7 +686,6 @@ session_free (session *killsess)
 	server *killserv = killsess->server;
 	session *sess;
 	GSList *list;
-	int oldidx;
 
 
 	if (current_tab == killsess)
@@ -633,14 +716,14 @@ session_free (session *killsess)
 	if (!killserv->server_session)
 		killserv->server_session = killserv->front_session;
 
+	session_index_remove (killsess);
 	sess_list = g_slist_remove (sess_list, killsess);
+	g_hash_table_remove (sess_live, killsess);
 
 	if (killsess->type == SESS_CHANNEL)
 		userlist_free (killsess);
 
-	oldidx = killsess->lastact_idx;
-	if (oldidx != LACT_NONE)
-		sess_list_by_lastact[oldidx] = g_list_remove(sess_list_by_lastact[oldidx], killsess);
+	lastact_unlink (killsess);
 
 	exec_notify_kill (killsess);
 
@@ -970,6 +1053,7 @@ hexchat_exit (void)
 	notify_save ();
 	ignore_save ();
 	free_sessions ();
+	log_shutdown ();
 	chanopt_save_all (TRUE);
 	servlist_cleanup ();
 	fe_exit ();
@@ -269,12 +269,17 @@ struct hexchatprefs
 	int hex_identd_port;
 	int hex_irc_ban_type;
 	int hex_irc_join_delay;
+	int hex_irc_log_sync;				/* fsync logs: 0=never 1=on close 2=after every batch */
 	int hex_irc_notice_pos;
 	int hex_net_ping_timeout;
 	int hex_net_proxy_port;
 	int hex_net_proxy_type;				/* 0=disabled, 1=wingate 2=socks4, 3=socks5, 4=http */
 	int hex_net_proxy_use;				/* 0=all 1=IRC_ONLY 2=DCC_ONLY */
+	int hex_net_read_lines;				/* lines handled per read wakeup, 0=unlimited */
 	int hex_net_reconnect_delay;
+	int hex_net_recv_buffer;			/* per-server receive buffer in KiB */
+	int hex_net_throttle_burst;		/* lines sent back to back before throttling */
+	int hex_net_throttle_delay;		/* ms each line costs once throttled */
 	int hex_notify_timeout;
 	int hex_text_max_indent;
 	int hex_text_max_lines;
@@ -377,17 +382,18 @@ typedef struct session
 	guint8 text_strip;
 
 	struct server *server;
-	tree *usertree;					/* alphabetical tree */
-	struct User *me;					/* points to myself in the usertree */
+	GHashTable *userhash;			/* struct person -> struct User */
+	tree *usertree;					/* alphabetical view of userhash, built on demand */
+	struct User *me;					/* points to myself in the userlist */
 	char channel[CHANLEN];
 	char waitchannel[CHANLEN];		  /* waiting to join channel (/join sent) */
 	char willjoinchannel[CHANLEN];	  /* will issue /join for this channel */
 	char session_name[CHANLEN];		 /* the name of the session, should not modified */
 	char channelkey[64];			  /* XXX correct max length? */
 	int limit;						  /* channel user limit */
-	int logfd;
+	struct log_file *logfile;	/* see text.c, NULL when not logging */
 
-	GFile *scrollfile;							/* scrollback file */
+	struct scrollback *scrollback;	/* see text.c, NULL until first used */
 	int scrollwritten;					/* number of lines written */
 
 	char lastnick[NICKLEN];			  /* last nick you /msg'ed */
@@ -415,11 +421,14 @@ typedef struct session
 
 	int lastact_idx;		/* the sess_list_by_lastact[] index of the list we're in.
 							 * For valid values, see defines of LACT_*. */
+	struct session *lastact_prev;	/* links within that list */
+	struct session *lastact_next;
 
 	int ignore_date:1;
 	int ignore_mode:1;
 	int ignore_names:1;
 	int end_of_names:1;
+	int names_pending:1;			/* NAMES users added, frontend not told yet */
 	int doing_who:1;		/* /who sent on this channel */
 	int done_away_check:1;	/* done checking for away status changes */
 	tab_state_flags tab_state;
@@ -435,6 +444,21 @@ typedef struct session
 #define MECH_SCRAM_SHA_256 3
 #define MECH_SCRAM_SHA_512 4
 
+/* one priority level of the send queue: a FIFO ring of queued lines */
+struct sendq_line
+{
+	char *buf;
+	int len;
+};
+
+struct sendq
+{
+	struct sendq_line *ring;
+	int size;			/* slots allocated, always a power of 2 */
+	int head;			/* index of the oldest line */
+	int count;
+};
+
 typedef struct server
 {
 	/*  server control operations (in server*.c) */
@@ -477,6 +501,7 @@ typedef struct server
 /*	void (*p_set_away)(struct server *);*/
 	int (*p_raw)(struct server *, char *raw);
 	int (*p_cmp)(const char *s1, const char *s2);
+	int casemapping;					/* CASEMAP_*, p_cmp and the index keys follow it */
 
 	int port;
 	int sok;					/* is equal to sok4 or sok6 (the one we are using) */
@@ -503,7 +528,10 @@ typedef struct server
 	int childpid;
 	int iotag;
 	int recondelay_tag;				/* reconnect delay timeout */
+	int read_tag;						/* resume handling recvbuf after the read budget ran out */
 	int joindelay_tag;				/* waiting before we send JOIN */
+	int send_tag;						/* flush sendbuf once the main loop is idle */
+	int send_wtag;						/* socket was full, finish sendbuf once writable */
 	char hostname[128];				/* real ip number */
 	char servername[128];			/* what the server says is its name */
 	char password[1024];
@@ -511,6 +539,15 @@ typedef struct server
 	char linebuf[8704];				/* RFC says 512 chars including \r\n, IRCv3 message tags add 8191, plus the NUL byte */
 	char *last_away_reason;
 	int pos;								/* current position in linebuf */
+	char *recvbuf;						/* data received but not handled yet */
+	int recvbuf_size;
+	int recv_start;					/* first unhandled byte in recvbuf */
+	int recv_len;						/* number of unhandled bytes in recvbuf */
+	struct arena *scratch;			/* per-line parse memory, reset after each read batch */
+	GString *sendbuf;					/* encoded lines waiting to go out in one write */
+	GHashTable *chan_index;			/* casefolded name -> channel session */
+	GHashTable *dialog_index;		/* casefolded nick -> dialog session */
+	GHashTable *people;				/* casefolded nick -> struct person, see userlist.c */
 	int nickcount;
 	int loginmethod;					/* see login_types[] */
 
@@ -523,9 +560,11 @@ typedef struct server
 
 	void *network;						/* points to entry in servlist.c or NULL! */
 
-	GSList *outbound_queue;
-	time_t next_send;						/* cptr->since in ircu */
-	time_t prev_now;					/* previous now-time */
+	struct sendq outbound_queue[3];		/* indexed by priority, 2 goes first */
+	gint64 next_send;						/* cptr->since in ircu, monotonic usecs */
+	int sendq_tag;						/* wakes the send queue when the next line is due */
+	int throttle_slowdown;			/* percent, raised when the server says we flooded */
+	gint64 throttle_calm;				/* last flood complaint, monotonic usecs */
 	int sendq_len;						/* queue size */
 	int lag;								/* milliseconds */
 
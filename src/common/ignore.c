@@ -46,6 +46,258 @@ int ignored_noti = 0;
 int ignored_invi = 0;
 static int ignored_total = 0;
 
+/* ignore_check() doesn't walk ignore_list. The masks are compiled into
+ * an index on their literal head and tail, and the verdict for each
+ * host is kept in a small LRU cache. Anything that changes the list
+ * calls ignore_changed() to throw both away.
+ */
+
+#define IGNORE_KEY_LEN 3		/* bytes of head/tail the index is keyed on */
+#define IGNORE_CACHE_MAX 512	/* hosts we remember a verdict for */
+
+struct ignore_rule
+{
+	struct ignore *ig;
+	char *fixed;				/* folded mask with the wildcard middle cut out */
+	int prelen;					/* literal bytes before the first wildcard */
+	int suflen;					/* literal bytes after the last one */
+	unsigned int literal:1;	/* no wildcards, fixed is the whole mask */
+};
+
+struct ignore_verdict
+{
+	GList link;					/* in ignore_lru, most recent first */
+	char *host;					/* folded */
+	unsigned int unig;		/* types of matching UNIGNOREs */
+	unsigned int ign;			/* types of matching ignores */
+};
+
+static GHashTable *ignore_exact;		/* folded mask -> rules, masks without wildcards */
+static GHashTable *ignore_by_tail;	/* last IGNORE_KEY_LEN bytes -> rules */
+static GHashTable *ignore_by_head;	/* first IGNORE_KEY_LEN bytes -> rules */
+static GSList *ignore_other;			/* everything too vague to index */
+static GSList *ignore_rules;			/* all of the above, for freeing */
+static gboolean ignore_compiled = FALSE;
+
+static GHashTable *ignore_cache;		/* folded host -> struct ignore_verdict */
+static GQueue ignore_lru = G_QUEUE_INIT;
+
+static void
+ignore_fold (char *str)
+{
+	for (; *str; str++)
+		*str = rfc_tolower (*str);
+}
+
+static void
+ignore_index_add (GHashTable *table, const char *key, struct ignore_rule *rule)
+{
+	GSList *list = g_hash_table_lookup (table, key);
+
+	/* link in behind the head so the stored value never changes */
+	if (list)
+		list->next = g_slist_prepend (list->next, rule);
+	else
+		g_hash_table_insert (table, g_strdup (key), g_slist_prepend (NULL, rule));
+}
+
+static void
+ignore_compile (void)
+{
+	struct ignore_rule *rule;
+	GSList *list;
+	char *mask, *wild;
+	int len, last;
+
+	ignore_exact = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_slist_free);
+	ignore_by_tail = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_slist_free);
+	ignore_by_head = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_slist_free);
+
+	for (list = ignore_list; list; list = list->next)
+	{
+		rule = g_new0 (struct ignore_rule, 1);
+		rule->ig = list->data;
+		ignore_rules = g_slist_prepend (ignore_rules, rule);
+
+		mask = rule->ig->mask;
+		/* escaped wildcards are rare enough to leave to match() */
+		if (strchr (mask, '\\'))
+		{
+			ignore_other = g_slist_prepend (ignore_other, rule);
+			continue;
+		}
+
+		len = strlen (mask);
+		wild = strpbrk (mask, "*?");
+		if (!wild)
+		{
+			rule->fixed = g_strdup (mask);
+			rule->literal = TRUE;
+			ignore_fold (rule->fixed);
+			ignore_index_add (ignore_exact, rule->fixed, rule);
+			continue;
+		}
+
+		for (last = len - 1; mask[last] != '*' && mask[last] != '?'; last--)
+			;
+		rule->prelen = wild - mask;
+		rule->suflen = len - last - 1;
+		rule->fixed = g_malloc (rule->prelen + rule->suflen + 1);
+		memcpy (rule->fixed, mask, rule->prelen);
+		strcpy (rule->fixed + rule->prelen, mask + last + 1);
+		ignore_fold (rule->fixed);
+
+		if (rule->suflen >= IGNORE_KEY_LEN)
+			ignore_index_add (ignore_by_tail, rule->fixed + rule->prelen + rule->suflen - IGNORE_KEY_LEN, rule);
+		else if (rule->prelen >= IGNORE_KEY_LEN)
+		{
+			char key[IGNORE_KEY_LEN + 1];
+
+			memcpy (key, rule->fixed, IGNORE_KEY_LEN);
+			key[IGNORE_KEY_LEN] = 0;
+			ignore_index_add (ignore_by_head, key, rule);
+		}
+		else
+			ignore_other = g_slist_prepend (ignore_other, rule);
+	}
+
+	ignore_compiled = TRUE;
+}
+
+static void
+ignore_verdict_free (struct ignore_verdict *verdict)
+{
+	g_free (verdict->host);
+	g_free (verdict);
+}
+
+/* call after anything in ignore_list is added, removed or changed */
+static void
+ignore_changed (void)
+{
+	GSList *list;
+	struct ignore_rule *rule;
+
+	if (ignore_cache)
+		g_hash_table_remove_all (ignore_cache);
+	g_queue_init (&ignore_lru);
+
+	if (!ignore_compiled)
+		return;
+
+	g_hash_table_destroy (ignore_exact);
+	g_hash_table_destroy (ignore_by_tail);
+	g_hash_table_destroy (ignore_by_head);
+	g_slist_free (ignore_other);
+	ignore_other = NULL;
+	for (list = ignore_rules; list; list = list->next)
+	{
+		rule = list->data;
+		g_free (rule->fixed);
+		g_free (rule);
+	}
+	g_slist_free (ignore_rules);
+	ignore_rules = NULL;
+	ignore_compiled = FALSE;
+}
+
+static void
+ignore_rules_match (GSList *list, const char *host, const char *folded,
+						  int len, struct ignore_verdict *verdict)
+{
+	struct ignore_rule *rule;
+
+	for (; list; list = list->next)
+	{
+		rule = list->data;
+
+		/* exact hits need no checking, the rest get cheap rejects on
+		   their literal ends before the real thing */
+		if (!rule->literal)
+		{
+			if (rule->fixed &&
+				 (rule->prelen + rule->suflen > len ||
+				  memcmp (rule->fixed, folded, rule->prelen) != 0 ||
+				  memcmp (rule->fixed + rule->prelen, folded + len - rule->suflen, rule->suflen) != 0))
+				continue;
+			if (!match (rule->ig->mask, host))
+				continue;
+		}
+
+		if (rule->ig->type & IG_UNIG)
+			verdict->unig |= rule->ig->type;
+		else
+			verdict->ign |= rule->ig->type;
+	}
+}
+
+static void
+ignore_verdict_fill (struct ignore_verdict *verdict, const char *host, const char *folded)
+{
+	char key[IGNORE_KEY_LEN + 1];
+	int len = strlen (folded);
+
+	if (!ignore_compiled)
+		ignore_compile ();
+
+	ignore_rules_match (g_hash_table_lookup (ignore_exact, folded), host, folded, len, verdict);
+	if (len >= IGNORE_KEY_LEN)
+	{
+		ignore_rules_match (g_hash_table_lookup (ignore_by_tail, folded + len - IGNORE_KEY_LEN),
+								  host, folded, len, verdict);
+		memcpy (key, folded, IGNORE_KEY_LEN);
+		key[IGNORE_KEY_LEN] = 0;
+		ignore_rules_match (g_hash_table_lookup (ignore_by_head, key), host, folded, len, verdict);
+	}
+	ignore_rules_match (ignore_other, host, folded, len, verdict);
+}
+
+static struct ignore_verdict *
+ignore_verdict (const char *host)
+{
+	struct ignore_verdict *verdict;
+	char buf[NICKLEN + USERNAMELEN + 256];	/* nick!user@host */
+	char *folded = buf;
+	gsize len = strlen (host);
+
+	/* only a verdict that goes into the cache needs its own copy */
+	if (len >= sizeof (buf))
+		folded = g_malloc (len + 1);
+	memcpy (folded, host, len + 1);
+	ignore_fold (folded);
+
+	if (!ignore_cache)
+		ignore_cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+														  (GDestroyNotify) ignore_verdict_free);
+
+	verdict = g_hash_table_lookup (ignore_cache, folded);
+	if (verdict)
+	{
+		if (folded != buf)
+			g_free (folded);
+		g_queue_unlink (&ignore_lru, &verdict->link);
+		g_queue_push_head_link (&ignore_lru, &verdict->link);
+		return verdict;
+	}
+
+	verdict = g_new0 (struct ignore_verdict, 1);
+	verdict->link.data = verdict;
+	verdict->host = folded == buf ? g_strdup (buf) : folded;
+	ignore_verdict_fill (verdict, host, verdict->host);
+
+	if (g_queue_get_length (&ignore_lru) >= IGNORE_CACHE_MAX)
+	{
+		struct ignore_verdict *oldest = g_queue_peek_tail (&ignore_lru);
+
+		g_queue_unlink (&ignore_lru, &oldest->link);
+		g_hash_table_remove (ignore_cache, oldest->host);
+	}
+	g_queue_push_head_link (&ignore_lru, &verdict->link);
+	g_hash_table_insert (ignore_cache, verdict->host, verdict);
+
+	return verdict;
+}
+
 /* ignore_exists ():
  * returns: struct ig, if this mask is in the ignore list already
  *          NULL, otherwise
@@ -99,6 +351,7 @@ ignore_add (char *mask, int type, gboolean overwrite)
 
 	if (!change_only)
 		ignore_list = g_slist_prepend (ignore_list, ig);
+	ignore_changed ();
 	fe_ignore_update (1);
 
 	if (change_only)
@@ -189,6 +442,7 @@ ignore_del (char *mask, struct ignore *ig)
 	if (ig)
 	{
 		ignore_list = g_slist_remove (ignore_list, ig);
+		ignore_changed ();
 		g_free (ig->mask);
 		g_free (ig);
 		fe_ignore_update (1);
@@ -202,52 +456,32 @@ ignore_del (char *mask, struct ignore *ig)
 int
 ignore_check (char *host, int type)
 {
-	struct ignore *ig;
-	GSList *list = ignore_list;
-
-	/* check if there's an UNIGNORE first, they take precendance. */
-	while (list)
-	{
-		ig = (struct ignore *) list->data;
-		if (ig->type & IG_UNIG)
-		{
-			if (ig->type & type)
-			{
-				if (match (ig->mask, host))
-					return FALSE;
-			}
-		}
-		list = list->next;
-	}
-
-	list = ignore_list;
-	while (list)
-	{
-		ig = (struct ignore *) list->data;
-
-		if (ig->type & type)
-		{
-			if (match (ig->mask, host))
-			{
-				ignored_total++;
-				if (type & IG_PRIV)
-					ignored_priv++;
-				if (type & IG_NOTI)
-					ignored_noti++;
-				if (type & IG_CHAN)
-					ignored_chan++;
-				if (type & IG_CTCP)
-					ignored_ctcp++;
-				if (type & IG_INVI)
-					ignored_invi++;
-				fe_ignore_update (2);
-				return TRUE;
-			}
-		}
-		list = list->next;
-	}
-
-	return FALSE;
+	struct ignore_verdict *verdict;
+
+	if (!ignore_list)
+		return FALSE;
+
+	verdict = ignore_verdict (host);
+
+	/* an UNIGNORE takes precendance */
+	if (verdict->unig & type)
+		return FALSE;
+	if (!(verdict->ign & type))
+		return FALSE;
+
+	ignored_total++;
+	if (type & IG_PRIV)
+		ignored_priv++;
+	if (type & IG_NOTI)
+		ignored_noti++;
+	if (type & IG_CHAN)
+		ignored_chan++;
+	if (type & IG_CTCP)
+		ignored_ctcp++;
+	if (type & IG_INVI)
+		ignored_invi++;
+	fe_ignore_update (2);
+	return TRUE;
 }
 
 static char *
@@ -298,6 +532,7 @@ ignore_load ()
 					g_free (ignore);
 			}
 			g_free (cfg);
+			ignore_changed ();
 		}
 		close (fh);
 	}
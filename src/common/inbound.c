@@ -54,6 +54,7 @@ clear_channel (session *sess)
 {
 	if (sess->channel[0])
 		strcpy (sess->waitchannel, sess->channel);
+	session_index_remove (sess);
 	sess->channel[0] = 0;
 	sess->doing_who = FALSE;
 	sess->done_away_check = FALSE;
@@ -83,11 +84,11 @@ set_topic (session *sess, char *topic, char *stripped_topic)
 {
 	/* The topic of dialogs are the users hostname which is logged is new */
 	if (sess->type == SESS_DIALOG && (!sess->topic || strcmp(sess->topic, stripped_topic))
-		&& sess->logfd != -1)
+		&& sess->logfile)
 	{
 		char tbuf[1024];
 		g_snprintf (tbuf, sizeof (tbuf), "[%s has address %s]\n", sess->channel, stripped_topic);
-		write (sess->logfd, tbuf, strlen (tbuf));
+		log_append (sess, tbuf);
 	}
 
 	g_free (sess->topic);
@@ -99,7 +100,7 @@ static session *
 find_session_from_nick (char *nick, server *serv)
 {
 	session *sess;
-	GSList *list = sess_list;
+	GSList *list;
 
 	sess = find_dialog (serv, nick);
 	if (sess)
@@ -118,16 +119,9 @@ find_session_from_nick (char *nick, server *serv)
 			return current_sess;
 	}
 
-	while (list)
-	{
-		sess = list->data;
-		if (sess->server == serv)
-		{
-			if (userlist_find (sess, nick))
-				return sess;
-		}
-		list = list->next;
-	}
+	list = userlist_sessions (serv, nick);
+	if (list)
+		return list->data;
 	return NULL;
 }
 
@@ -205,7 +199,7 @@ inbound_privmsg (server *serv, char *from, char *ip, char *text, int id,
 	if (user)
 	{
 		user->lasttalk = time (0);
-		if (user->account)
+		if (user->person->account)
 			id = TRUE;
 	}
 	
@@ -302,19 +296,201 @@ alert_match_text (char *text, char *masks)
 	}
 }
 
+/* The hilight prefs compiled for is_hilight(): masks without wildcards
+   go in a hash of their folded form, so checking a word is one lookup
+   plus a match() for each wildcard mask. Recompiled when the pref's
+   string changes. */
+struct alert_masks
+{
+	char *source;				/* the pref string this was built from */
+	GHashTable *literal;		/* set of folded masks */
+	GSList *wild;				/* masks with * or ? */
+	gboolean any;				/* a mask of just *s matches everything */
+};
+
+static struct alert_masks hilight_extra;
+static struct alert_masks hilight_nick;
+static struct alert_masks hilight_none;
+
+static void
+alert_fold (char *str)
+{
+	for (; *str; str++)
+		*str = rfc_tolower (*str);
+}
+
+static struct alert_masks *
+alert_masks_compile (struct alert_masks *set, const char *masks)
+{
+	char **tokens, **tok;
+
+	if (set->source && strcmp (set->source, masks) == 0)
+		return set;
+
+	g_free (set->source);
+	if (set->literal)
+		g_hash_table_destroy (set->literal);
+	g_slist_free_full (set->wild, g_free);
+
+	set->source = g_strdup (masks);
+	set->literal = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	set->wild = NULL;
+	set->any = FALSE;
+
+	/* same separators as alert_match_word() */
+	tokens = g_strsplit_set (masks, " ,", -1);
+	for (tok = tokens; *tok; tok++)
+	{
+		g_strchug (*tok);
+		if (!**tok)
+			continue;
+
+		if (!strpbrk (*tok, "*?"))
+		{
+			alert_fold (*tok);
+			g_hash_table_insert (set->literal, g_strdup (*tok), NULL);
+		}
+		else if ((*tok)[strspn (*tok, "*")] == 0)
+			set->any = TRUE;
+		else
+			set->wild = g_slist_prepend (set->wild, g_strdup (*tok));
+	}
+	g_strfreev (tokens);
+
+	return set;
+}
+
+/* word is already folded */
+static gboolean
+alert_masks_match (struct alert_masks *set, const char *word)
+{
+	GSList *list;
+
+	if (set->any || g_hash_table_contains (set->literal, word))
+		return TRUE;
+
+	for (list = set->wild; list; list = list->next)
+	{
+		if (match (list->data, word))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean
+alert_masks_match_nick (server *serv, struct alert_masks *set, char *masks, char *nick)
+{
+	char *folded;
+
+	alert_masks_compile (set, masks);
+	if (!set->any && !set->wild && g_hash_table_size (set->literal) == 0)
+		return FALSE;
+
+	folded = arena_strndup (serv->scratch, nick, strlen (nick));
+	alert_fold (folded);
+	return alert_masks_match (set, folded);
+}
+
+/* Walks text once, splitting it into words the way alert_match_text()
+   does and skipping the codes strip_color (STRIP_ALL) would remove, and
+   checks each word against our nick and the extra hilight masks. */
+static gboolean
+alert_scan_text (server *serv, char *text)
+{
+	const unsigned char *p = (unsigned char *) text;
+	struct alert_masks *set;
+	char nick[NICKLEN];
+	char *word, *w;
+	int rcol = 0, bgcol = 0;
+	int skip, i;
+
+	set = alert_masks_compile (&hilight_extra, prefs.hex_irc_extra_hilight);
+	if (set->any)
+		return TRUE;
+
+	safe_strcpy (nick, serv->nick, sizeof (nick));
+	alert_fold (nick);
+
+	w = word = arena_alloc (serv->scratch, strlen (text) + 1);
+
+	for (;; p += skip)
+	{
+		skip = 1;
+
+		if (rcol > 0 && (isdigit (*p) || (*p == ',' && isdigit (p[1]) && !bgcol)))
+		{
+			if (p[1] != ',')
+				rcol--;
+			if (*p == ',')
+			{
+				rcol = 2;
+				bgcol = 1;
+			}
+			continue;
+		}
+		rcol = bgcol = 0;
+
+		switch (*p)
+		{
+		case '\003':
+			rcol = 2;
+			continue;
+		case HIDDEN_CHAR:
+		case '\007': case '\017': case '\026': case '\002':
+		case '\037': case '\036': case '\035':
+			continue;
+
+		/* if it's RFC1459 <special>, it can be inside a word */
+		case '-': case '[': case ']': case '\\':
+		case '`': case '^': case '{': case '}':
+		case '_': case '|':
+			*w++ = rfc_tolower (*p);
+			continue;
+		}
+
+		if (isdigit (*p))
+		{
+			*w++ = *p;
+			continue;
+		}
+
+		if (*p != 0 && *p != ' ' && *p != ',' && g_unichar_isalpha (g_utf8_get_char ((char *) p)))
+		{
+			skip = g_utf8_skip[*p];
+			for (i = 0; i < skip && p[i]; i++)
+				*w++ = rfc_tolower (p[i]);
+			skip = i;
+			continue;
+		}
+
+		/* anything else ends the word */
+		if (w > word)
+		{
+			*w = 0;
+			if ((nick[0] && strcmp (word, nick) == 0) || alert_masks_match (set, word))
+				return TRUE;
+			w = word;
+		}
+
+		if (*p == 0)
+			return FALSE;
+		skip = g_utf8_skip[*p];
+		for (i = 1; i < skip && p[i]; i++)
+			;
+		skip = i;
+	}
+}
+
 static int
 is_hilight (char *from, char *text, session *sess, server *serv)
 {
-	if (alert_match_word (from, prefs.hex_irc_no_hilight))
+	if (alert_masks_match_nick (serv, &hilight_none, prefs.hex_irc_no_hilight, from))
 		return 0;
 
-	text = strip_color (text, -1, STRIP_ALL);
-
-	if (alert_match_text (text, serv->nick) ||
-		 alert_match_text (text, prefs.hex_irc_extra_hilight) ||
-		 alert_match_word (from, prefs.hex_irc_nick_hilight))
+	if (alert_scan_text (serv, text) ||
+		 alert_masks_match_nick (serv, &hilight_nick, prefs.hex_irc_nick_hilight, from))
 	{
-		g_free (text);
 		if (sess != current_tab)
 		{
 			sess->tab_state |= TAB_STATE_NEW_HILIGHT;
@@ -323,7 +499,6 @@ is_hilight (char *from, char *text, session *sess, server *serv)
 		return 1;
 	}
 
-	g_free (text);
 	return 0;
 }
 
@@ -385,7 +560,7 @@ inbound_action (session *sess, char *chan, char *from, char *ip, char *text,
 	{
 		nickchar[0] = user->prefix[0];
 		user->lasttalk = time (0);
-		if (user->account)
+		if (user->person->account)
 			id = TRUE;
 		if (user->me)
 			fromme = TRUE;
@@ -451,7 +626,7 @@ inbound_chanmsg (server *serv, session *sess, char *chan, char *from,
 	user = userlist_find (sess, from);
 	if (user)
 	{
-		if (user->account)
+		if (user->person->account)
 			id = TRUE;
 		nickchar[0] = user->prefix[0];
 		user->lasttalk = time (0);
@@ -490,7 +665,7 @@ inbound_newnick (server *serv, char *nick, char *newnick, int quiet,
 {
 	int me = FALSE;
 	session *sess;
-	GSList *list = sess_list;
+	GSList *list, *chans;
 
 	if (!serv->p_cmp (nick, serv->nick))
 	{
@@ -498,33 +673,57 @@ inbound_newnick (server *serv, char *nick, char *newnick, int quiet,
 		safe_strcpy (serv->nick, newnick, NICKLEN);
 	}
 
-	while (list)
+	/* the channels they're in; our own nick also shows in the server tab */
+	chans = g_slist_copy (userlist_sessions (serv, nick));
+	userlist_change (serv, nick, newnick);
+	if (me)
+	{
+		for (list = sess_list; list; list = list->next)
+		{
+			sess = list->data;
+			if (sess->server == serv && sess->type == SESS_SERVER)
+				chans = g_slist_prepend (chans, sess);
+		}
+	}
+
+	if (!quiet)
+	{
+		for (list = chans; list; list = list->next)
+		{
+			if (me)
+				EMIT_SIGNAL_TIMESTAMP (XP_TE_UCHANGENICK, list->data, nick, 
+											  newnick, NULL, NULL, 0,
+											  tags_data->timestamp);
+			else
+				EMIT_SIGNAL_TIMESTAMP (XP_TE_CHANGENICK, list->data, nick,
+											  newnick, NULL, NULL, 0, tags_data->timestamp);
+		}
+	}
+
+	sess = find_dialog (serv, nick);
+	if (sess)
+	{
+		session_index_remove (sess);
+		safe_strcpy (sess->channel, newnick, CHANLEN);
+		session_index_add (sess);
+		fe_set_channel (sess);
+		fe_set_title (sess);
+	}
+
+	/* our nick is in every title of this server, theirs only in the
+	   channels they share with us */
+	if (me)
+	{
+		g_slist_free (chans);
+		chans = g_slist_copy (sess_list);
+	}
+	for (list = chans; list; list = list->next)
 	{
 		sess = list->data;
 		if (sess->server == serv)
-		{
-			if (userlist_change (sess, nick, newnick) || (me && sess->type == SESS_SERVER))
-			{
-				if (!quiet)
-				{
-					if (me)
-						EMIT_SIGNAL_TIMESTAMP (XP_TE_UCHANGENICK, sess, nick, 
-													  newnick, NULL, NULL, 0,
-													  tags_data->timestamp);
-					else
-						EMIT_SIGNAL_TIMESTAMP (XP_TE_CHANGENICK, sess, nick,
-													  newnick, NULL, NULL, 0, tags_data->timestamp);
-				}
-			}
-			if (sess->type == SESS_DIALOG && !serv->p_cmp (sess->channel, nick))
-			{
-				safe_strcpy (sess->channel, newnick, CHANLEN);
-				fe_set_channel (sess);
-			}
 			fe_set_title (sess);
-		}
-		list = list->next;
 	}
+	g_slist_free (chans);
 
 	dcc_change_nick (serv, nick, newnick);
 
@@ -594,7 +793,9 @@ inbound_ujoin (server *serv, char *chan, char *nick, char *ip,
 		}
 	}
 
+	session_index_remove (sess);
 	safe_strcpy (sess->channel, chan, CHANLEN);
+	session_index_add (sess);
 	if (found_unused)
 	{
 		chanopt_load (sess);
@@ -670,10 +871,8 @@ inbound_nameslist (server *serv, char *chan, char *names,
 						 const message_tags_data *tags_data)
 {
 	session *sess;
-	char **name_list;
-	char *host, *nopre_name;
+	char *p, *next, *host, *nopre_name, save;
 	char name[NICKLEN];
-	int i;
 	size_t offset;
 
 	sess = find_channel (serv, chan);
@@ -693,19 +892,27 @@ inbound_nameslist (server *serv, char *chan, char *names,
 		userlist_clear (sess);
 	}
 
-	name_list = g_strsplit (names, " ", -1);
-	for (i = 0; name_list[i]; i++)
+	/* users go in as they arrive, so MODE, PART and the like in the
+	   middle of a NAMES find them; only the frontend and notify wait
+	   for end of names */
+	for (p = names; *p; p = next)
 	{
+		next = p + strcspn (p, " ");
+		if (next == p)
+		{
+			next++;
+			continue;
+		}
+		save = *next;
+		*next = 0;
+
 		host = NULL;
 		offset = sizeof(name);
 
-		if (name_list[i][0] == 0)
-			continue;
-
 		if (serv->have_uhnames)
 		{
 			offset = 0;
-			nopre_name = name_list[i];
+			nopre_name = p;
 
 			/* Ignore prefixes so '!' won't cause issues */
 			while (strchr (serv->nick_prefixes, *nopre_name) != NULL)
@@ -715,15 +922,28 @@ inbound_nameslist (server *serv, char *chan, char *names,
 			}
 
 			offset += strcspn (nopre_name, "!");
-			if (offset++ < strlen (name_list[i]))
-				host = name_list[i] + offset;
+			if (offset++ < strlen (p))
+				host = p + offset;
 		}
 
-		g_strlcpy (name, name_list[i], MIN(offset, sizeof(name)));
+		g_strlcpy (name, p, MIN(offset, sizeof(name)));
+
+		userlist_add_quiet (sess, name, host);
 
-		userlist_add (sess, name, host, NULL, NULL, tags_data);
+		*next = save;
 	}
-	g_strfreev (name_list);
+
+	sess->names_pending = TRUE;
+}
+
+static void
+inbound_nameslist_flush (session *sess, const message_tags_data *tags_data)
+{
+	if (!sess->names_pending)
+		return;
+
+	sess->names_pending = FALSE;
+	userlist_add_done (sess, tags_data);
 }
 
 void
@@ -827,30 +1047,30 @@ void
 inbound_quit (server *serv, char *nick, char *ip, char *reason,
 				  const message_tags_data *tags_data)
 {
-	GSList *list = sess_list;
+	GSList *list, *chans;
 	session *sess;
 	struct User *user;
-	int was_on_front_session = FALSE;
+	int was_on_front_session = current_sess && current_sess->server == serv;
 
-	while (list)
+	/* userlist_remove_user changes the membership list as we go */
+	chans = g_slist_copy (userlist_sessions (serv, nick));
+	for (list = chans; list; list = list->next)
 	{
-		sess = (session *) list->data;
-		if (sess->server == serv)
+		sess = list->data;
+		if ((user = userlist_find (sess, nick)))
 		{
- 			if (sess == current_sess)
- 				was_on_front_session = TRUE;
-			if ((user = userlist_find (sess, nick)))
-			{
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_QUIT, sess, nick, reason, ip, NULL, 0,
-											  tags_data->timestamp);
-				userlist_remove_user (sess, user);
-			} else if (sess->type == SESS_DIALOG && !serv->p_cmp (sess->channel, nick))
-			{
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_QUIT, sess, nick, reason, ip, NULL, 0,
-											  tags_data->timestamp);
-			}
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_QUIT, sess, nick, reason, ip, NULL, 0,
+										  tags_data->timestamp);
+			userlist_remove_user (sess, user);
 		}
-		list = list->next;
+	}
+	g_slist_free (chans);
+
+	sess = find_dialog (serv, nick);
+	if (sess)
+	{
+		EMIT_SIGNAL_TIMESTAMP (XP_TE_QUIT, sess, nick, reason, ip, NULL, 0,
+									  tags_data->timestamp);
 	}
 
 	notify_set_offline (serv, nick, was_on_front_session, tags_data);
@@ -860,17 +1080,7 @@ void
 inbound_account (server *serv, char *nick, char *account,
 					  const message_tags_data *tags_data)
 {
-	session *sess = NULL;
-	GSList *list;
-
-	list = sess_list;
-	while (list)
-	{
-		sess = list->data;
-		if (sess->server == serv)
-			userlist_set_account (sess, nick, account);
-		list = list->next;
-	}
+	userlist_set_account (serv, nick, account);
 }
 
 void
@@ -1041,7 +1251,6 @@ inbound_away (server *serv, char *nick, char *msg,
 {
 	struct away_msg *away = server_away_find_message (serv, nick);
 	session *sess = NULL;
-	GSList *list;
 
 	if (away && !strcmp (msg, away->message))	/* Seen the msg before? */
 	{
@@ -1067,41 +1276,25 @@ inbound_away (server *serv, char *nick, char *msg,
 		EMIT_SIGNAL_TIMESTAMP (XP_TE_WHOIS5, sess, nick, msg, NULL, NULL, 0,
 									  tags_data->timestamp);
 
-	list = sess_list;
-	while (list)
-	{
-		sess = list->data;
-		if (sess->server == serv)
-			userlist_set_away (sess, nick, TRUE);
-		list = list->next;
-	}
+	userlist_set_away (serv, nick, TRUE);
 }
 
 void
 inbound_away_notify (server *serv, char *nick, char *reason,
 							const message_tags_data *tags_data)
 {
-	session *sess = NULL;
-	GSList *list;
+	session *sess = serv->front_session;
 
-	list = sess_list;
-	while (list)
+	userlist_set_away (serv, nick, reason ? TRUE : FALSE);
+
+	if (sess && notify_is_in_list (serv, nick))
 	{
-		sess = list->data;
-		if (sess->server == serv)
-		{
-			userlist_set_away (sess, nick, reason ? TRUE : FALSE);
-			if (sess == serv->front_session && notify_is_in_list (serv, nick))
-			{
-				if (reason)
-					EMIT_SIGNAL_TIMESTAMP (XP_TE_NOTIFYAWAY, sess, nick, reason, NULL,
-												  NULL, 0, tags_data->timestamp);
-				else
-					EMIT_SIGNAL_TIMESTAMP (XP_TE_NOTIFYBACK, sess, nick, NULL, NULL, 
-												  NULL, 0, tags_data->timestamp);
-			}
-		}
-		list = list->next;
+		if (reason)
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_NOTIFYAWAY, sess, nick, reason, NULL,
+										  NULL, 0, tags_data->timestamp);
+		else
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_NOTIFYBACK, sess, nick, NULL, NULL, 
+										  NULL, 0, tags_data->timestamp);
 	}
 }
 
@@ -1120,6 +1313,7 @@ inbound_nameslist_end (server *serv, char *chan,
 			sess = list->data;
 			if (sess->server == serv)
 			{
+				inbound_nameslist_flush (sess, tags_data);
 				sess->end_of_names = TRUE;
 				sess->ignore_names = FALSE;
 				fe_userlist_numbers (sess);
@@ -1131,6 +1325,7 @@ inbound_nameslist_end (server *serv, char *chan,
 	sess = find_channel (serv, chan);
 	if (sess)
 	{
+		inbound_nameslist_flush (sess, tags_data);
 		sess->end_of_names = TRUE;
 		sess->ignore_names = FALSE;
 		fe_userlist_numbers (sess);
@@ -1382,17 +1577,7 @@ inbound_login_start (session *sess, char *nick, char *servname,
 static void
 inbound_set_all_away_status (server *serv, char *nick, unsigned int status)
 {
-	GSList *list;
-	session *sess;
-
-	list = sess_list;
-	while (list)
-	{
-		sess = list->data;
-		if (sess->server == serv)
-			userlist_set_away (sess, nick, status);
-		list = list->next;
-	}
+	userlist_set_away (serv, nick, status);
 }
 
 void
@@ -1471,21 +1656,13 @@ inbound_user_info (session *sess, char *chan, char *user, char *host,
 	else
 	{
 		/* came from WHOIS, not channel specific */
-		for (list = sess_list; list; list = list->next)
-		{
-			sess = list->data;
-			if (sess->server != serv)
-				continue;
+		list = userlist_sessions (serv, nick);
+		if (list)
+			userlist_add_hostname (list->data, nick, uhost, realname, servname, account, away);
 
-			if (sess->type == SESS_CHANNEL)
-			{
-				userlist_add_hostname (sess, nick, uhost, realname, servname, account, away);
-			}
-			else if (sess->type == SESS_DIALOG && uhost && !serv->p_cmp (sess->channel, nick))
-			{
-				set_topic (sess, uhost, uhost);
-			}
-		}
+		sess = find_dialog (serv, nick);
+		if (sess && uhost)
+			set_topic (sess, uhost, uhost);
 	}
 
 	g_free (uhost);
@@ -906,7 +906,11 @@ inbound_005 (server * serv, char *word[], const message_tags_data *tags_data)
 		} else if (g_strcmp0 (tokname, "CASEMAPPING") == 0)
 		{
 			if (g_strcmp0 (tokvalue, "ascii") == 0)
-				serv->p_cmp = (void *)g_ascii_strcasecmp;
+				server_set_casemapping (serv, CASEMAP_ASCII);
+			else if (g_strcmp0 (tokvalue, "strict-rfc1459") == 0)
+				server_set_casemapping (serv, CASEMAP_STRICT_RFC1459);
+			else
+				server_set_casemapping (serv, CASEMAP_RFC1459);
 		} else if (g_strcmp0 (tokname, "CHARSET") == 0)
 		{
 			if (g_ascii_strcasecmp (tokvalue, "UTF-8") == 0)
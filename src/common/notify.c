@@ -284,6 +284,30 @@ notify_set_online (server * serv, char *nick,
 	notify_announce_online (serv, servnot, nick, tags_data);
 }
 
+/* a whole channel's worth of users arrived (NAMES): check each notify
+   entry once against the channel instead of each user against the list */
+
+void
+notify_set_online_channel (session *sess, const message_tags_data *tags_data)
+{
+	GSList *list;
+	struct notify *notify;
+	struct notify_per_server *servnot;
+	struct User *user;
+
+	for (list = notify_list; list; list = list->next)
+	{
+		notify = (struct notify *) list->data;
+		servnot = notify_find_server_entry (notify, sess->server);
+		if (!servnot)
+			continue;
+
+		user = userlist_find (sess, notify->name);
+		if (user)
+			notify_announce_online (sess->server, servnot, user->person->nick, tags_data);
+	}
+}
+
 /* monitor can send lists for numeric 730/731 */
 
 void
@@ -206,6 +206,41 @@ server_sendquit (session * sess)
 	}
 }
 
+/* Without quote handling, valid UTF-8 is copied byte for byte, so copy the
+   whole line at once and only visit the spaces. Gives the same words as the
+   loop in process_data_init(), but runs of spaces are NULed in place instead
+   of being squeezed out. Every line from the server goes through here. */
+
+static void
+process_data_split (char *buf, char *cmd, char *word[], char *word_eol[])
+{
+	int wordcount = 2;
+	char *sp = buf;
+
+	strcpy (buf, cmd);
+
+	while (wordcount < PDIWORDS && (sp = strchr (sp, ' ')))
+	{
+		*sp++ = 0;
+		word_eol[wordcount] = cmd + (sp - buf);
+
+		while (*sp == ' ')
+			*sp++ = 0;
+		word[wordcount] = sp;
+		wordcount++;
+	}
+
+	/* the last word still ends at the next space */
+	if (sp && (sp = strchr (sp, ' ')))
+		*sp = 0;
+
+	for (; wordcount < PDIWORDS; wordcount++)
+	{
+		word[wordcount] = "\000\000";
+		word_eol[wordcount] = "\000\000";
+	}
+}
+
 void
 process_data_init (char *buf, char *cmd, char *word[],
 						 char *word_eol[], gboolean handle_quotes,
@@ -222,6 +257,12 @@ process_data_init (char *buf, char *cmd, char *word[],
 	word[1] = buf;
 	word_eol[1] = cmd;
 
+	if (!handle_quotes)
+	{
+		process_data_split (buf, cmd, word, word_eol);
+		return;
+	}
+
 	while (1)
 	{
 		switch (*cmd)
@@ -477,14 +518,14 @@ create_mask (session * sess, char *mask, char *mode, char *typestr, int deop)
 	char username[64], fullhost[128], domain[128], buf[512], *p2;
 
 	user = userlist_find (sess, mask);
-	if (user && user->hostname)  /* it's a nickname, let's find a proper ban mask */
+	if (user && user->person->hostname)  /* it's a nickname, let's find a proper ban mask */
 	{
 		if (deop)
-			p2 = user->nick;
+			p2 = user->person->nick;
 		else
 			p2 = "";
 
-		mask = user->hostname;
+		mask = user->person->hostname;
 
 		at = strchr (mask, '@');	/* FIXME: utf8 */
 		if (!at)
@@ -1045,7 +1086,7 @@ mdehop_cb (struct User *user, multidata *data)
 {
 	if (user->hop && !user->me)
 	{
-		data->nicks[data->i] = user->nick;
+		data->nicks[data->i] = user->person->nick;
 		data->i++;
 	}
 	return TRUE;
@@ -1059,7 +1100,7 @@ cmd_mdehop (struct session *sess, char *tbuf, char *word[], char *word_eol[])
 
 	data.nicks = nicks;
 	data.i = 0;
-	tree_foreach (sess->usertree, (tree_traverse_func *)mdehop_cb, &data);
+	userlist_foreach (sess, (tree_traverse_func *)mdehop_cb, &data);
 	send_channel_modes (sess, tbuf, nicks, 0, data.i, '-', 'h', 0);
 	g_free (nicks);
 
@@ -1071,7 +1112,7 @@ mdeop_cb (struct User *user, multidata *data)
 {
 	if (user->op && !user->me)
 	{
-		data->nicks[data->i] = user->nick;
+		data->nicks[data->i] = user->person->nick;
 		data->i++;
 	}
 	return TRUE;
@@ -1085,7 +1126,7 @@ cmd_mdeop (struct session *sess, char *tbuf, char *word[], char *word_eol[])
 
 	data.nicks = nicks;
 	data.i = 0;
-	tree_foreach (sess->usertree, (tree_traverse_func *)mdeop_cb, &data);
+	userlist_foreach (sess, (tree_traverse_func *)mdeop_cb, &data);
 	send_channel_modes (sess, tbuf, nicks, 0, data.i, '-', 'o', 0);
 	g_free (nicks);
 
@@ -1399,7 +1440,7 @@ mhop_cb (struct User *user, multidata *data)
 {
 	if (!user->hop)
 	{
-		data->nicks[data->i] = user->nick;
+		data->nicks[data->i] = user->person->nick;
 		data->i++;
 	}
 	return TRUE;
@@ -1413,7 +1454,7 @@ cmd_mhop (struct session *sess, char *tbuf, char *word[], char *word_eol[])
 
 	data.nicks = nicks;
 	data.i = 0;
-	tree_foreach (sess->usertree, (tree_traverse_func *)mhop_cb, &data);
+	userlist_foreach (sess, (tree_traverse_func *)mhop_cb, &data);
 	send_channel_modes (sess, tbuf, nicks, 0, data.i, '+', 'h', 0);
 
 	g_free (nicks);
@@ -1425,7 +1466,7 @@ static int
 mkick_cb (struct User *user, multidata *data)
 {
 	if (!user->op && !user->me)
-		data->sess->server->p_kick (data->sess->server, data->sess->channel, user->nick, data->reason);
+		data->sess->server->p_kick (data->sess->server, data->sess->channel, user->person->nick, data->reason);
 	return TRUE;
 }
 
@@ -1433,7 +1474,7 @@ static int
 mkickops_cb (struct User *user, multidata *data)
 {
 	if (user->op && !user->me)
-		data->sess->server->p_kick (data->sess->server, data->sess->channel, user->nick, data->reason);
+		data->sess->server->p_kick (data->sess->server, data->sess->channel, user->person->nick, data->reason);
 	return TRUE;
 }
 
@@ -1444,8 +1485,8 @@ cmd_mkick (struct session *sess, char *tbuf, char *word[], char *word_eol[])
 
 	data.sess = sess;
 	data.reason = word_eol[2];
-	tree_foreach (sess->usertree, (tree_traverse_func *)mkickops_cb, &data);
-	tree_foreach (sess->usertree, (tree_traverse_func *)mkick_cb, &data);
+	userlist_foreach (sess, (tree_traverse_func *)mkickops_cb, &data);
+	userlist_foreach (sess, (tree_traverse_func *)mkick_cb, &data);
 
 	return TRUE;
 }
@@ -1487,9 +1528,9 @@ cmd_dns (struct session *sess, char *tbuf, char *word[], char *word_eol[])
 		user = userlist_find (sess, nick);
 		if (user)
 		{
-			if (user->hostname)
+			if (user->person->hostname)
 			{
-				do_dns (sess, user->nick, user->hostname, &no_tags);
+				do_dns (sess, user->person->nick, user->person->hostname, &no_tags);
 			} else
 			{
 				sess->server->p_get_ip (sess->server, nick);
@@ -2693,8 +2734,8 @@ split_up_text(struct session *sess, char *text, int cmd_length, char *split_text
 	max -= cmd_length;
 	max -= strlen (sess->server->nick);
 	max -= strlen (sess->channel);
-	if (sess->me && sess->me->hostname)
-		max -= strlen (sess->me->hostname);
+	if (sess->me && sess->me->person->hostname)
+		max -= strlen (sess->me->person->hostname);
 	else
 	{
 		max -= 9;	/* username */
@@ -2824,7 +2865,7 @@ mop_cb (struct User *user, multidata *data)
 {
 	if (!user->op)
 	{
-		data->nicks[data->i] = user->nick;
+		data->nicks[data->i] = user->person->nick;
 		data->i++;
 	}
 	return TRUE;
@@ -2838,7 +2879,7 @@ cmd_mop (struct session *sess, char *tbuf, char *word[], char *word_eol[])
 
 	data.nicks = nicks;
 	data.i = 0;
-	tree_foreach (sess->usertree, (tree_traverse_func *)mop_cb, &data);
+	userlist_foreach (sess, (tree_traverse_func *)mop_cb, &data);
 	send_channel_modes (sess, tbuf, nicks, 0, data.i, '+', 'o', 0);
 
 	g_free (nicks);
@@ -3811,7 +3852,7 @@ userlist_cb (struct User *user, session *sess)
 		lt = time (0) - user->lasttalk;
 	PrintTextf (sess,
 				"\00306%s\t\00314[\00310%-38s\00314] \017ov\0033=\017%d%d away=%u lt\0033=\017%ld\n",
-				user->nick, user->hostname, user->op, user->voice, user->away, (long)lt);
+				user->person->nick, user->person->hostname, user->op, user->voice, user->person->away, (long)lt);
 
 	return TRUE;
 }
@@ -3842,7 +3883,7 @@ static int
 cmd_userlist (struct session *sess, char *tbuf, char *word[],
 				  char *word_eol[])
 {
-	tree_foreach (sess->usertree, (tree_traverse_func *)userlist_cb, sess);
+	userlist_foreach (sess, (tree_traverse_func *)userlist_cb, sess);
 	return TRUE;
 }
 
@@ -3853,7 +3894,7 @@ wallchop_cb (struct User *user, multidata *data)
 	{
 		if (data->i)
 			strcat (data->tbuf, ",");
-		strcat (data->tbuf, user->nick);
+		strcat (data->tbuf, user->person->nick);
 		data->i++;
 	}
 	if (data->i == 5)
@@ -3883,7 +3924,7 @@ cmd_wallchop (struct session *sess, char *tbuf, char *word[],
 	data.tbuf = tbuf;
 	data.i = 0;
 	data.sess = sess;
-	tree_foreach (sess->usertree, (tree_traverse_func*)wallchop_cb, &data);
+	userlist_foreach (sess, (tree_traverse_func*)wallchop_cb, &data);
 
 	if (data.i)
 	{
@@ -4468,12 +4509,12 @@ nick_comp_cb (struct User *user, nickdata *data)
 {
 	int lenu;
 
-	if (!rfc_ncasecmp (user->nick, data->nick, data->len))
+	if (!rfc_ncasecmp (user->person->nick, data->nick, data->len))
 	{
-		lenu = strlen (user->nick);
+		lenu = strlen (user->person->nick);
 		if (lenu == data->len)
 		{
-			g_snprintf (data->tbuf, TBUFSIZE, "%s%s", user->nick, data->space);
+			g_snprintf (data->tbuf, TBUFSIZE, "%s%s", user->person->nick, data->space);
 			data->len = -1;
 			return FALSE;
 		} else if (lenu < data->bestlen)
@@ -4510,14 +4551,14 @@ perform_nick_completion (struct session *sess, char *cmd, char *tbuf)
 				data.best = NULL;
 				data.tbuf = tbuf;
 				data.space = space - 1;
-				tree_foreach (sess->usertree, (tree_traverse_func *)nick_comp_cb, &data);
+				userlist_foreach (sess, (tree_traverse_func *)nick_comp_cb, &data);
 
 				if (data.len == -1)
 					return;
 
 				if (data.best)
 				{
-					g_snprintf (tbuf, TBUFSIZE, "%s%s", data.best->nick, space - 1);
+					g_snprintf (tbuf, TBUFSIZE, "%s%s", data.best->person->nick, space - 1);
 					return;
 				}
 			}
@@ -507,6 +507,7 @@ process_numeric (session * sess, int n,
 		goto def;
 
 	case 263:	/*Server load is temporarily too heavy */
+		server_throttle_backoff (serv, FALSE);
 		if (fe_is_chanwindow (sess->server))
 		{
 			fe_chan_list_end (sess->server);
@@ -1006,6 +1007,19 @@ process_numeric (session * sess, int n,
 	}
 }
 
+/* Dispatch slot of a named message, made from its length and its first,
+ * second and last letters. The multipliers are picked so every verb handled
+ * below gets a slot of its own, which lets the switch compile to a single
+ * jump table. Two verbs sharing a slot is a duplicate case label, so a new
+ * verb that collides won't build rather than quietly slowing things down. */
+#define VERB_SLOT(len, c0, c1, cl) (((len) * 5 + (c0) * 4 + (c1) + (cl) * 7) & 63)
+
+/* case label for a verb, c0/c1/cl are its first, second and last letters */
+#define VERB_CASE(verb, c0, c1, cl) \
+	case VERB_SLOT (sizeof (verb) - 1, c0, c1, cl): \
+		if (strcmp (type, verb) != 0) \
+			goto garbage;
+
 /* handle named messages that starts with a ':' */
 
 static void
@@ -1040,349 +1054,322 @@ process_named_msg (session *sess, char *type, char *word[], char *word_eol[],
 		inbound_account (serv, nick, account, tags_data);
 	}
 
-	if (len == 4)
-	{
-		guint32 t;
+	if (len < 3)
+		goto garbage;
 
-		t = WORDL((guint8)type[0], (guint8)type[1], (guint8)type[2], (guint8)type[3]); 	
-		/* this should compile to a bunch of: CMP.L, JE ... nice & fast */
-		switch (t)
+	switch (VERB_SLOT (len, (guint8)type[0], (guint8)type[1], (guint8)type[len - 1]))
+	{
+	VERB_CASE ("JOIN", 'J', 'O', 'N')
 		{
-		case WORDL('J','O','I','N'):
-			{
-				char *chan = word[3];
-				char *account = word[4];
-				char *realname = word_eol[5];
-
-				if (account && strcmp (account, "*") == 0)
-					account = NULL;
-				if (realname && *realname == ':')
-					realname++;
-				if (*chan == ':')
-					chan++;
-				if (!serv->p_cmp (nick, serv->nick))
-					inbound_ujoin (serv, chan, nick, ip, tags_data);
-				else
-					inbound_join (serv, chan, nick, ip, account, realname,
-									  tags_data);
-			}
-			return;
-
-		case WORDL('K','I','C','K'):
-			{
-				char *kicked = word[4];
-				char *reason = word_eol[5];
-				if (*kicked)
-				{
-					if (*reason == ':')
-						reason++;
-					if (!strcmp (kicked, serv->nick))
-	 					inbound_ukick (serv, word[3], nick, reason, tags_data);
-					else
-						inbound_kick (serv, word[3], kicked, nick, reason, tags_data);
-				}
-			}
-			return;
-
-		case WORDL('K','I','L','L'):
-			{
-				char *reason = word_eol[4];
-				if (*reason == ':')
-					reason++;
-
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_KILL, sess, nick, reason, NULL, NULL,
-											  0, tags_data->timestamp);
-			}
-			return;
-
-		case WORDL('M','O','D','E'):
-			handle_mode (serv, word, word_eol, nick, FALSE, tags_data);	/* modes.c */
-			return;
-
-		case WORDL('N','I','C','K'):
-			inbound_newnick (serv, nick, 
-								  (word_eol[3][0] == ':') ? word_eol[3] + 1 : word_eol[3],
-								  FALSE, tags_data);
-			return;
+			char *chan = word[3];
+			char *account = word[4];
+			char *realname = word_eol[5];
+
+			if (account && strcmp (account, "*") == 0)
+				account = NULL;
+			if (realname && *realname == ':')
+				realname++;
+			if (*chan == ':')
+				chan++;
+			if (!serv->p_cmp (nick, serv->nick))
+				inbound_ujoin (serv, chan, nick, ip, tags_data);
+			else
+				inbound_join (serv, chan, nick, ip, account, realname,
+								  tags_data);
+		}
+		return;
 
-		case WORDL('P','A','R','T'):
+	VERB_CASE ("KICK", 'K', 'I', 'K')
+		{
+			char *kicked = word[4];
+			char *reason = word_eol[5];
+			if (*kicked)
 			{
-				char *chan = word[3];
-				char *reason = word_eol[4];
-
-				if (*chan == ':')
-					chan++;
 				if (*reason == ':')
 					reason++;
-				if (!strcmp (nick, serv->nick))
-					inbound_upart (serv, chan, ip, reason, tags_data);
+				if (!strcmp (kicked, serv->nick))
+ 					inbound_ukick (serv, word[3], nick, reason, tags_data);
 				else
-					inbound_part (serv, chan, nick, ip, reason, tags_data);
+					inbound_kick (serv, word[3], kicked, nick, reason, tags_data);
 			}
-			return;
+		}
+		return;
 
-		case WORDL('P', 'I', 'N', 'G'):
-			tcp_sendf (sess->server, "PONG %s\r\n", word_eol[3]);
-			return;
+	VERB_CASE ("KILL", 'K', 'I', 'L')
+		{
+			char *reason = word_eol[4];
+			if (*reason == ':')
+				reason++;
 
-		case WORDL('P','O','N','G'):
-			inbound_ping_reply (serv->server_session,
-									  (word[4][0] == ':') ? word[4] + 1 : word[4],
-									  word[3], tags_data);
-			return;
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_KILL, sess, nick, reason, NULL, NULL,
+										  0, tags_data->timestamp);
+		}
+		return;
+
+	VERB_CASE ("MODE", 'M', 'O', 'E')
+		handle_mode (serv, word, word_eol, nick, FALSE, tags_data);	/* modes.c */
+		return;
 
-		case WORDL('Q','U','I','T'):
-			inbound_quit (serv, nick, ip,
+	VERB_CASE ("NICK", 'N', 'I', 'K')
+		inbound_newnick (serv, nick, 
 							  (word_eol[3][0] == ':') ? word_eol[3] + 1 : word_eol[3],
-							  tags_data);
-			return;
+							  FALSE, tags_data);
+		return;
 
-		case WORDL('A','W','A','Y'):
-			inbound_away_notify (serv, nick,
-										(word_eol[3][0] == ':') ? word_eol[3] + 1 : NULL,
-										tags_data);
-			return;
+	VERB_CASE ("PART", 'P', 'A', 'T')
+		{
+			char *chan = word[3];
+			char *reason = word_eol[4];
+
+			if (*chan == ':')
+				chan++;
+			if (*reason == ':')
+				reason++;
+			if (!strcmp (nick, serv->nick))
+				inbound_upart (serv, chan, ip, reason, tags_data);
+			else
+				inbound_part (serv, chan, nick, ip, reason, tags_data);
+		}
+		return;
 
-		case WORDL('F','A','I','L'):
-			text = STRIP_COLON(word, word_eol, trailing_index(word_eol));
-			if (g_strcmp0(word[3], "*") == 0)
-			{
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_FAIL, sess, word[4], text, NULL, NULL, NULL, tags_data->timestamp);
-			} else
-			{
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_FAILCMD, sess, word[3], word[4], text, NULL, NULL, tags_data->timestamp);
-			}
-			return;
+	VERB_CASE ("PING", 'P', 'I', 'G')
+		tcp_sendf (sess->server, "PONG %s\r\n", word_eol[3]);
+		return;
 
-		case WORDL('W','A','R','N'):
-			text = STRIP_COLON(word, word_eol, trailing_index(word_eol));
-			if (g_strcmp0(word[3], "*") == 0)
-			{
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_WARN, sess, word[4], text, NULL, NULL, NULL, tags_data->timestamp);
-			} else
-			{
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_WARNCMD, sess, word[3], word[4], text, NULL, NULL, tags_data->timestamp);
-			}
-			return;
+	VERB_CASE ("PONG", 'P', 'O', 'G')
+		inbound_ping_reply (serv->server_session,
+								  (word[4][0] == ':') ? word[4] + 1 : word[4],
+								  word[3], tags_data);
+		return;
 
-		case WORDL('N','O','T','E'):
-			text = STRIP_COLON(word, word_eol, trailing_index(word_eol));
-			if (g_strcmp0(word[3], "*") == 0)
-			{
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_NOTE, sess, word[4], text, NULL, NULL, NULL, tags_data->timestamp);
-			} else
-			{
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_NOTECMD, sess, word[3], word[4], text, NULL, NULL, tags_data->timestamp);
-			}
-			return;
-		}
+	VERB_CASE ("QUIT", 'Q', 'U', 'T')
+		inbound_quit (serv, nick, ip,
+						  (word_eol[3][0] == ':') ? word_eol[3] + 1 : word_eol[3],
+						  tags_data);
+		return;
 
-		goto garbage;
-	}
+	VERB_CASE ("AWAY", 'A', 'W', 'Y')
+		inbound_away_notify (serv, nick,
+									(word_eol[3][0] == ':') ? word_eol[3] + 1 : NULL,
+									tags_data);
+		return;
 
-	else if (len >= 5)
-	{
-		guint32 t;
+	VERB_CASE ("FAIL", 'F', 'A', 'L')
+		text = STRIP_COLON(word, word_eol, trailing_index(word_eol));
+		if (g_strcmp0(word[3], "*") == 0)
+		{
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_FAIL, sess, word[4], text, NULL, NULL, NULL, tags_data->timestamp);
+		} else
+		{
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_FAILCMD, sess, word[3], word[4], text, NULL, NULL, tags_data->timestamp);
+		}
+		return;
 
-		t = WORDL((guint8)type[0], (guint8)type[1], (guint8)type[2], (guint8)type[3]); 	
-		/* this should compile to a bunch of: CMP.L, JE ... nice & fast */
-		switch (t)
+	VERB_CASE ("WARN", 'W', 'A', 'N')
+		text = STRIP_COLON(word, word_eol, trailing_index(word_eol));
+		if (g_strcmp0(word[3], "*") == 0)
+		{
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_WARN, sess, word[4], text, NULL, NULL, NULL, tags_data->timestamp);
+		} else
 		{
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_WARNCMD, sess, word[3], word[4], text, NULL, NULL, tags_data->timestamp);
+		}
+		return;
 
-		case WORDL('A','C','C','O'):
-			inbound_account (serv, nick, STRIP_COLON(word, word_eol, 3), tags_data);
-			return;
+	VERB_CASE ("NOTE", 'N', 'O', 'E')
+		text = STRIP_COLON(word, word_eol, trailing_index(word_eol));
+		if (g_strcmp0(word[3], "*") == 0)
+		{
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_NOTE, sess, word[4], text, NULL, NULL, NULL, tags_data->timestamp);
+		} else
+		{
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_NOTECMD, sess, word[3], word[4], text, NULL, NULL, tags_data->timestamp);
+		}
+		return;
 
-		case WORDL('A', 'U', 'T', 'H'):
-			inbound_sasl_authenticate (sess->server, word_eol[3]);
-			return;
+	VERB_CASE ("ACCOUNT", 'A', 'C', 'T')
+		inbound_account (serv, nick, STRIP_COLON(word, word_eol, 3), tags_data);
+		return;
 
-		case WORDL('C', 'H', 'G', 'H'):
-			inbound_user_info (sess, NULL, word[3], STRIP_COLON(word, word_eol, 4), NULL, nick, NULL,
-							   NULL, 0xff, tags_data);
-			return;
+	VERB_CASE ("AUTHENTICATE", 'A', 'U', 'E')
+		inbound_sasl_authenticate (sess->server, word_eol[3]);
+		return;
 
-		case WORDL('S', 'E', 'T', 'N'):
-			inbound_user_info (sess, NULL, NULL, NULL, NULL, nick, STRIP_COLON(word, word_eol, 3),
-							   NULL, 0xff, tags_data);
-			return;
+	VERB_CASE ("CHGHOST", 'C', 'H', 'T')
+		inbound_user_info (sess, NULL, word[3], STRIP_COLON(word, word_eol, 4), NULL, nick, NULL,
+						   NULL, 0xff, tags_data);
+		return;
 
-		case WORDL('I','N','V','I'):
-			if (ignore_check (word[1], IG_INVI))
-				return;
+	VERB_CASE ("SETNAME", 'S', 'E', 'E')
+		inbound_user_info (sess, NULL, NULL, NULL, NULL, nick, STRIP_COLON(word, word_eol, 3),
+						   NULL, 0xff, tags_data);
+		return;
 
-			text = STRIP_COLON(word, word_eol, 4);
-			if (serv->p_cmp (word[3], serv->nick))
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_INVITEDOTHER, sess, text, nick,
-											  word[3], serv->servername, 0,
-											  tags_data->timestamp);
-			else
-				EMIT_SIGNAL_TIMESTAMP (XP_TE_INVITED, sess, text, nick,
-											  serv->servername, NULL, 0,
-											  tags_data->timestamp);
-				
+	VERB_CASE ("INVITE", 'I', 'N', 'E')
+		if (ignore_check (word[1], IG_INVI))
 			return;
 
-		case WORDL('N','O','T','I'):
+		text = STRIP_COLON(word, word_eol, 4);
+		if (serv->p_cmp (word[3], serv->nick))
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_INVITEDOTHER, sess, text, nick,
+										  word[3], serv->servername, 0,
+										  tags_data->timestamp);
+		else
+			EMIT_SIGNAL_TIMESTAMP (XP_TE_INVITED, sess, text, nick,
+										  serv->servername, NULL, 0,
+										  tags_data->timestamp);
+			
+		return;
+
+	VERB_CASE ("NOTICE", 'N', 'O', 'E')
+		{
+			text = word_eol[4];
+			if (*text == ':')
 			{
-				text = word_eol[4];
-				if (*text == ':')
-				{
-					text++;
-				}
+				text++;
+			}
 
 #ifdef USE_OPENSSL
-				/* QuakeNet CHALLENGE upon our request */
-				if (serv->loginmethod == LOGIN_CHALLENGEAUTH && !serv->p_cmp (word[1], CHALLENGEAUTH_FULLHOST)
-				    && !strncmp (text, "CHALLENGE ", 10) && *serv->password)
-				{
-					char *response;
-					ircnet *net = serv->network;
-					char *user = net && net->user ? net->user : prefs.hex_irc_user_name;
+			/* QuakeNet CHALLENGE upon our request */
+			if (serv->loginmethod == LOGIN_CHALLENGEAUTH && !serv->p_cmp (word[1], CHALLENGEAUTH_FULLHOST)
+			    && !strncmp (text, "CHALLENGE ", 10) && *serv->password)
+			{
+				char *response;
+				ircnet *net = serv->network;
+				char *user = net && net->user ? net->user : prefs.hex_irc_user_name;
 
-					response = challengeauth_response (user, serv->password, word[5]);
+				response = challengeauth_response (user, serv->password, word[5]);
 
-					tcp_sendf (serv, "PRIVMSG %s :CHALLENGEAUTH %s %s %s\r\n",
-						CHALLENGEAUTH_NICK,
-						user,
-						response,
-						CHALLENGEAUTH_ALGO);
+				tcp_sendf (serv, "PRIVMSG %s :CHALLENGEAUTH %s %s %s\r\n",
+					CHALLENGEAUTH_NICK,
+					user,
+					response,
+					CHALLENGEAUTH_ALGO);
 
-					g_free (response);
-					return;									/* omit the CHALLENGE <hash> ALGOS message */
-				}
+				g_free (response);
+				return;									/* omit the CHALLENGE <hash> ALGOS message */
+			}
 #endif
 
-				if (!ignore_check (word[1], IG_NOTI))
-					inbound_notice (serv, word[3], nick, text, ip, tags_data->identified, tags_data);
-			}
-			return;
+			if (!ignore_check (word[1], IG_NOTI))
+				inbound_notice (serv, word[3], nick, text, ip, tags_data->identified, tags_data);
+		}
+		return;
 
-		case WORDL('P','R','I','V'):
+	VERB_CASE ("PRIVMSG", 'P', 'R', 'G')
+		{
+			char *to = word[3];
+			int len;
+			if (*to)
 			{
-				char *to = word[3];
-				int len;
-				if (*to)
+				/* Handle limited channel messages, for now no special event */
+				if (strchr (serv->chantypes, to[0]) == NULL
+					&& strchr (serv->nick_prefixes, to[0]) != NULL)
+					to++;
+					
+				text = word_eol[4];
+				if (*text == ':')
+					text++;
+
+				len = strlen (text);
+				if (text[0] == 1)	/* ctcp */
 				{
-					/* Handle limited channel messages, for now no special event */
-					if (strchr (serv->chantypes, to[0]) == NULL
-						&& strchr (serv->nick_prefixes, to[0]) != NULL)
-						to++;
-						
-					text = word_eol[4];
-					if (*text == ':')
-						text++;
-
-					len = strlen (text);
-					if (text[0] == 1)	/* ctcp */
+					char *new_pdibuf = NULL;
+					if (text[len - 1] == 1)
 					{
-						char *new_pdibuf = NULL;
-						if (text[len - 1] == 1)
-						{
-							text[len - 1] = 0;
-						}
-						text++;
-						if (g_ascii_strncasecmp (text, "ACTION", 6) != 0)
-							flood_check (nick, ip, serv, sess, 0);
-						if (g_ascii_strncasecmp (text, "DCC ", 4) == 0)
+						text[len - 1] = 0;
+					}
+					text++;
+					if (g_ascii_strncasecmp (text, "ACTION", 6) != 0)
+						flood_check (nick, ip, serv, sess, 0);
+					if (g_ascii_strncasecmp (text, "DCC ", 4) == 0)
+					{
+						int i;
+						char *new_word[PDIWORDS+1] = { NULL };
+						char *new_word_eol[PDIWORDS+1] = { NULL };
+
+						new_pdibuf = arena_alloc (serv->scratch, strlen (word_eol[6]) + 1);
+
+						/* This is a bit ugly but we handle the contents of the DCC message containing
+						 * "quoted paths for files" here which means reparsing the message with handle_quotes.
+						 * We avoid reparsing the entire message to avoid corrupting the non DCC parts.
+						 * Greater than PDIWORD length DCC messages will be truncated. */
+						process_data_init (new_pdibuf, word_eol[6], new_word, new_word_eol, TRUE, FALSE);
+						for (i = 6; i < PDIWORDS; ++i)
 						{
-							int i;
-							char *new_word[PDIWORDS+1] = { NULL };
-							char *new_word_eol[PDIWORDS+1] = { NULL };
-
-							new_pdibuf = g_malloc (strlen (word_eol[6]) + 1);
-
-							/* This is a bit ugly but we handle the contents of the DCC message containing
-							 * "quoted paths for files" here which means reparsing the message with handle_quotes.
-							 * We avoid reparsing the entire message to avoid corrupting the non DCC parts.
-							 * Greater than PDIWORD length DCC messages will be truncated. */
-							process_data_init (new_pdibuf, word_eol[6], new_word, new_word_eol, TRUE, FALSE);
-							for (i = 6; i < PDIWORDS; ++i)
-							{
-								word[i] = new_word[i - 5];
-								word_eol[i] = new_word_eol[i - 5];
-							}
+							word[i] = new_word[i - 5];
+							word_eol[i] = new_word_eol[i - 5];
 						}
+					}
 
-						ctcp_handle (sess, to, nick, ip, text, word, word_eol, tags_data->identified,
-										 tags_data);
+					ctcp_handle (sess, to, nick, ip, text, word, word_eol, tags_data->identified,
+									 tags_data);
 
-						/* Note word will be invalid beyond this scope */
-						g_free (new_pdibuf);
+					/* Note word will be invalid beyond this scope */
+				} else
+				{
+					if (is_channel (serv, to))
+					{
+						if (ignore_check (word[1], IG_CHAN))
+							return;
+						inbound_chanmsg (serv, NULL, to, nick, text, FALSE, tags_data->identified,
+											  tags_data);
 					} else
 					{
-						if (is_channel (serv, to))
-						{
-							if (ignore_check (word[1], IG_CHAN))
-								return;
-							inbound_chanmsg (serv, NULL, to, nick, text, FALSE, tags_data->identified,
-												  tags_data);
-						} else
-						{
-							if (ignore_check (word[1], IG_PRIV))
-								return;
-							inbound_privmsg (serv, nick, ip, text, tags_data->identified, tags_data);
-						}
+						if (ignore_check (word[1], IG_PRIV))
+							return;
+						inbound_privmsg (serv, nick, ip, text, tags_data->identified, tags_data);
 					}
 				}
 			}
-			return;
-
-		case WORDL('T','O','P','I'):
-			inbound_topicnew (serv, nick, word[3],
-									(word_eol[4][0] == ':') ? word_eol[4] + 1 : word_eol[4],
-									tags_data);
-			return;
-
-		case WORDL('W','A','L','L'):
-			text = word_eol[3];
-			if (*text == ':')
-				text++;
-			EMIT_SIGNAL_TIMESTAMP (XP_TE_WALLOPS, sess, nick, text, NULL, NULL, 0,
-										  tags_data->timestamp);
-			return;
 		}
-	}
+		return;
 
-	else if (len == 3)
-	{
-		guint32 t;
+	VERB_CASE ("TOPIC", 'T', 'O', 'C')
+		inbound_topicnew (serv, nick, word[3],
+								(word_eol[4][0] == ':') ? word_eol[4] + 1 : word_eol[4],
+								tags_data);
+		return;
 
-		t = WORDL((guint8)type[0], (guint8)type[1], (guint8)type[2], (guint8)type[3]);
-		switch (t)
-		{
-			case WORDL('C','A','P','\0'):
-				if (strncasecmp (word[4], "ACK", 3) == 0)
-				{
-					inbound_cap_ack (serv, word[1], 
-										  word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
-										  tags_data);
-				}
-				else if (strncasecmp (word[4], "LS", 2) == 0 || strncasecmp (word[4], "NEW", 3) == 0)
-				{
-					inbound_cap_ls (serv, word[1], 
-										 word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
-										 tags_data);
-				}
-				else if (strncasecmp (word[4], "NAK", 3) == 0)
-				{
-					inbound_cap_nak (serv, word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5], tags_data);
-				}
-				else if (strncasecmp (word[4], "LIST", 4) == 0)	
-				{
-					inbound_cap_list (serv, word[1], 
-											word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
-											tags_data);
-				}
-				else if (strncasecmp (word[4], "DEL", 3) == 0)
-				{
-					inbound_cap_del (serv, word[1],
-											word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
-											tags_data);
-				}
+	VERB_CASE ("WALLOPS", 'W', 'A', 'S')
+		text = word_eol[3];
+		if (*text == ':')
+			text++;
+		EMIT_SIGNAL_TIMESTAMP (XP_TE_WALLOPS, sess, nick, text, NULL, NULL, 0,
+									  tags_data->timestamp);
+		return;
 
-				return;
+	VERB_CASE ("CAP", 'C', 'A', 'P')
+		if (strncasecmp (word[4], "ACK", 3) == 0)
+		{
+			inbound_cap_ack (serv, word[1], 
+								  word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
+								  tags_data);
 		}
+		else if (strncasecmp (word[4], "LS", 2) == 0 || strncasecmp (word[4], "NEW", 3) == 0)
+		{
+			inbound_cap_ls (serv, word[1], 
+								 word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
+								 tags_data);
+		}
+		else if (strncasecmp (word[4], "NAK", 3) == 0)
+		{
+			inbound_cap_nak (serv, word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5], tags_data);
+		}
+		else if (strncasecmp (word[4], "LIST", 4) == 0)	
+		{
+			inbound_cap_list (serv, word[1], 
+									word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
+									tags_data);
+		}
+		else if (strncasecmp (word[4], "DEL", 3) == 0)
+		{
+			inbound_cap_del (serv, word[1],
+									word[5][0] == ':' ? word_eol[5] + 1 : word_eol[5],
+									tags_data);
+		}
+
+		return;
 	}
 
 garbage:
@@ -1405,6 +1392,8 @@ process_named_servermsg (session *sess, char *buf, char *rawname, char *word_eol
 	}
 	if (!strncmp (buf, "ERROR", 5))
 	{
+		if (strstr (buf, "Excess Flood"))
+			server_throttle_backoff (sess->server, TRUE);
 		EMIT_SIGNAL_TIMESTAMP (XP_TE_SERVERERROR, sess, buf + 7, NULL, NULL, NULL,
 									  0, tags_data->timestamp);
 		return;
@@ -1429,32 +1418,39 @@ process_named_servermsg (session *sess, char *buf, char *rawname, char *word_eol
 								  rawname, NULL, 0, tags_data->timestamp);
 }
 
-/* Returns the timezone offset. This should be the same as the variable
- * "timezone" in time.h, but *BSD doesn't have it.
+/* Number of days between 1970-01-01 and the given date of the proleptic
+ * Gregorian calendar. This is days_from_civil() from Howard Hinnant's
+ * date algorithms, so UTC times can be converted without mktime() and
+ * the local timezone.
  */
-static time_t
-get_timezone (void)
+static gint64
+days_from_civil (int year, int mon, int mday)
 {
-	struct tm tm_utc, tm_local;
-	time_t t, time_utc, time_local;
+	int era, yoe, doy, doe;
 
-	time (&t);
+	year -= mon <= 2;
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (mon > 2 ? mon - 3 : mon + 9) + 2) / 5 + mday - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
 
-	/* gmtime() and localtime() are thread-safe on windows.
-	 * on other systems we should use {gmtime,localtime}_r().
-	 */
-#if WIN32
-	tm_utc = *gmtime (&t);
-	tm_local = *localtime (&t);
-#else
-	gmtime_r (&t, &tm_utc);
-	localtime_r (&t, &tm_local);
-#endif
+	return (gint64) era * 146097 + doe - 719468;
+}
+
+/* Parses exactly n decimal digits, returns -1 if there aren't n of them */
+static int
+parse_digits (const char *str, int n)
+{
+	int val = 0;
 
-	time_utc = mktime (&tm_utc);
-	time_local = mktime (&tm_local);
+	while (n--)
+	{
+		if (!g_ascii_isdigit (*str))
+			return -1;
+		val = val * 10 + (*str++ - '0');
+	}
 
-	return time_utc - time_local;
+	return val;
 }
 
 /* Handle time-server tags.
@@ -1472,94 +1468,153 @@ handle_message_tag_time (const char *time, message_tags_data *tags_data)
 	 * but znc simply sends a unix time (with 3 decimal places for miliseconds)
 	 * so we might as well support both.
 	 */
-	if (!*time)
+	int len = strlen (time);
+
+	if (!len)
 		return;
 	
-	if (time[strlen (time) - 1] == 'Z')
+	if (time[len - 1] == 'Z')
 	{
 		/* as defined in the specification */
-		struct tm t;
-		int z;
-
-		/* we ignore the milisecond part */
-		z = sscanf (time, "%d-%d-%dT%d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday,
-					&t.tm_hour, &t.tm_min, &t.tm_sec);
+		int year, mon, mday, hour, min, sec;
+		gint64 t;
 
-		if (z != 6)
+		if (len < 20 || time[4] != '-' || time[7] != '-' || time[10] != 'T'
+			 || time[13] != ':' || time[16] != ':')
 			return;
 
-		t.tm_year -= 1900;
-		t.tm_mon -= 1;
-		t.tm_isdst = 0; /* day light saving time */
-
-		tags_data->timestamp = mktime (&t);
+		/* we ignore the milisecond part */
+		year = parse_digits (time, 4);
+		mon = parse_digits (time + 5, 2);
+		mday = parse_digits (time + 8, 2);
+		hour = parse_digits (time + 11, 2);
+		min = parse_digits (time + 14, 2);
+		sec = parse_digits (time + 17, 2);
+
+		if (year < 0 || mon < 1 || mon > 12 || mday < 1 || mday > 31 ||
+			 hour < 0 || hour > 23 || min < 0 || min > 59 || sec < 0 || sec > 60)
+			return;
 
-		if (tags_data->timestamp < 0)
-		{
-			tags_data->timestamp = 0;
+		t = days_from_civil (year, mon, mday) * 86400 + hour * 3600 + min * 60 + sec;
+		if (t < 0)
 			return;
-		}
 
-		/* get rid of the local time (mktime() receives a local calendar time) */
-		tags_data->timestamp -= get_timezone();
+		tags_data->timestamp = (time_t) t;
 	}
 	else
 	{
 		/* znc */
-		long long int t;
+		gint64 t = 0;
+		const char *p;
 
 		/* we ignore the milisecond part */
-		if (
-#if defined(__MINGW64__) || defined(__MINGW32__)
-		__mingw_sscanf
-#else
-		sscanf
-#endif
-		(time, "%lld", &t) != 1)
+		for (p = time; g_ascii_isdigit (*p); p++)
+			t = t * 10 + (*p - '0');
+
+		if (p == time)
 			return;
 
 		tags_data->timestamp = (time_t) t;
 	}
 }
 
-/* Handle message tags.
+/* Unescape a message tag value in place.
  *
- * See http://ircv3.atheme.org/specification/message-tags-3.2 
+ * See https://ircv3.net/specs/extensions/message-tags#escaping-values
  */
 static void
-handle_message_tags (server *serv, const char *tags_str,
-							message_tags_data *tags_data)
+message_tag_unescape (char *value)
 {
-	char **tags;
-	int i;
+	char *src, *dst;
 
-	/* FIXME We might want to avoid the allocation overhead here since 
-	 * this might be called for every message from the server.
-	 */
-	tags = g_strsplit (tags_str, ";", 0);
+	src = dst = strchr (value, '\\');
+	if (!src)
+		return;
 
-	for (i=0; tags[i]; i++)
+	while (*src)
 	{
-		char *key = tags[i];
-		char *value = strchr (tags[i], '=');
-
-		if (!value)
+		if (*src != '\\')
+		{
+			*dst++ = *src++;
 			continue;
+		}
 
-		*value = '\0';
-		value++;
+		src++;
+		switch (*src)
+		{
+		case ':':
+			*dst++ = ';';
+			break;
+		case 's':
+			*dst++ = ' ';
+			break;
+		case 'r':
+			*dst++ = '\r';
+			break;
+		case 'n':
+			*dst++ = '\n';
+			break;
+		case '\0':
+			/* a trailing backslash is dropped */
+			*dst = '\0';
+			return;
+		default:
+			/* "\\" and unknown escapes give the character itself */
+			*dst++ = *src;
+		}
+		src++;
+	}
 
-		if (serv->have_account_tag && !strcmp (key, "account"))
-			tags_data->account = g_strdup (value);
+	*dst = '\0';
+}
 
-		if (serv->have_idmsg && strcmp (key, "solanum.chat/identified"))
-			tags_data->identified = TRUE;
+/* Handle message tags. tags_str is split and unescaped in place, so the
+ * strings in tags_data point into the line and need no allocation.
+ *
+ * See http://ircv3.atheme.org/specification/message-tags-3.2 
+ */
+static void
+handle_message_tags (server *serv, char *tags_str,
+							message_tags_data *tags_data)
+{
+	char *key, *value, *next;
+
+	for (key = tags_str; key; key = next)
+	{
+		next = strchr (key, ';');
+		if (next)
+			*next++ = '\0';
+
+		/* client-only tags start with '+', none of them interest us */
+		if (*key == '+')
+			continue;
+
+		/* tags without a value count as an empty one */
+		value = strchr (key, '=');
+		if (value)
+			*value++ = '\0';
+		else
+			value = key + strlen (key);
 
-		if (serv->have_server_time && !strcmp (key, "time"))
-			handle_message_tag_time (value, tags_data);
+		switch (*key)
+		{
+		case 'a':
+			if (serv->have_account_tag && *value && !strcmp (key, "account"))
+			{
+				message_tag_unescape (value);
+				tags_data->account = value;
+			}
+			break;
+		case 't':
+			if (serv->have_server_time && !strcmp (key, "time"))
+				handle_message_tag_time (value, tags_data);
+			break;
+		case 's':
+			if (serv->have_idmsg && !strcmp (key, "solanum.chat/identified"))
+				tags_data->identified = TRUE;
+			break;
+		}
 	}
-	
-	g_strfreev (tags);
 }
 
 /* irc_inline() - 1 single line received from serv */
@@ -1573,7 +1628,7 @@ irc_inline (server *serv, char *buf, int len)
 	char *pdibuf;
 	message_tags_data tags_data = MESSAGE_TAGS_DATA_INIT;
 
-	pdibuf = g_malloc (len + 1);
+	pdibuf = arena_alloc (serv->scratch, len + 1);
 
 	sess = serv->front_session;
 
@@ -1587,7 +1642,7 @@ irc_inline (server *serv, char *buf, int len)
 		char *sep = strchr (buf, ' ');
 
 		if (!sep)
-			goto xit;
+			return;
 		
 		*sep = '\0';
 		buf = sep + 1;
@@ -1625,7 +1680,7 @@ irc_inline (server *serv, char *buf, int len)
 	if (buf[0] != ':')
 	{
 		process_named_servermsg (sess, buf, word[0], word_eol, &tags_data);
-		goto xit;
+		return;
 	}
 
 	/* see if the second word is a numeric */
@@ -1640,16 +1695,6 @@ irc_inline (server *serv, char *buf, int len)
 	{
 		process_named_msg (sess, type, word, word_eol, &tags_data);
 	}
-
-xit:
-	message_tags_data_free (&tags_data);
-	g_free (pdibuf);
-}
-
-void
-message_tags_data_free (message_tags_data *tags_data)
-{
-	g_clear_pointer (&tags_data->account, g_free);
 }
 
 void
@@ -1687,5 +1732,6 @@ proto_fill_her_up (server *serv)
 	serv->p_names = irc_names;
 	serv->p_ping = irc_ping;
 	serv->p_raw = irc_raw;
-	serv->p_cmp = rfc_casecmp;	/* can be changed by 005 in modes.c */
+	/* p_cmp belongs to server_set_casemapping, which keeps it in step
+	   with serv->casemapping and the folded keys */
 }
@@ -32,7 +32,8 @@
 
 #define STRIP_COLON(word, word_eol, idx) (word)[(idx)][0] == ':' ? (word_eol)[(idx)]+1 : (word)[(idx)]
 
-/* Message tag information that might be passed along with a server message
+/* Message tag information that might be passed along with a server message.
+ * The strings are only valid while the message is being processed.
  *
  * See http://ircv3.atheme.org/specification/capability-negotiation-3.1
  */
@@ -43,8 +44,6 @@ typedef struct
 	time_t timestamp;
 } message_tags_data;
 
-void message_tags_data_free (message_tags_data *tags_data);
-
 void proto_fill_her_up (server *serv);
 
 #endif
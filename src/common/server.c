@@ -54,6 +54,7 @@
 #include "proto-irc.h"
 #include "servlist.h"
 #include "server.h"
+#include "userlist.h"
 
 #ifdef USE_OPENSSL
 #include <openssl/ssl.h>		  /* SSL_() */
@@ -68,11 +69,14 @@ static struct session *g_sess = NULL;
 
 static GSList *away_list = NULL;
 GSList *serv_list = NULL;
+static GHashTable *serv_live = NULL;	/* the same servers, for is_server */
 
 static void auto_reconnect (server *serv, int send_quit, int err);
 static void server_disconnect (session * sess, int sendquit, int err);
 static int server_cleanup (server * serv);
 static void server_connect (server *serv, char *hostname, int port, int no_login);
+static gboolean server_read (GIOChannel *source, GIOCondition condition, server *serv);
+static void tcp_send_queue (server *serv);
 
 static void
 write_error (char *message, GError **error)
@@ -107,110 +111,305 @@ tcp_send_real (void *ssl, int sok, GIConv write_converter, char *buf, int len)
 	return ret;
 }
 
+/* lines sent in one go are gathered into a single write, but never more
+   than fits in one TLS record. Whatever the socket doesn't take stays
+   in sendbuf until it's writable again. */
+#define SENDBUF_MAX 16384
+
+static gboolean server_send_writable (GIOChannel *source, GIOCondition condition, server *serv);
+
+/* returns -1 if the connection is gone */
+static int
+server_send_flush (server *serv)
+{
+	int len, sent, ret = 0;
+
+	if (serv->send_tag)
+	{
+		fe_timeout_remove (serv->send_tag);
+		serv->send_tag = 0;
+	}
+
+	while (serv->sendbuf->len)
+	{
+		len = MIN (serv->sendbuf->len, SENDBUF_MAX);
+#ifdef USE_OPENSSL
+		if (serv->ssl)
+			sent = _SSL_send (serv->ssl, serv->sendbuf->str, len);
+		else
+#endif
+			sent = send (serv->sok, serv->sendbuf->str, len, 0);
+
+		if (sent < 0 && would_block ())
+		{
+			/* try again from the start of sendbuf once it can be written */
+			if (!serv->send_wtag)
+				serv->send_wtag = fe_input_add (serv->sok, FIA_WRITE, server_send_writable, serv);
+			return 0;
+		}
+		if (sent <= 0)
+		{
+			/* server_read will notice the disconnect */
+			g_string_truncate (serv->sendbuf, 0);
+			ret = -1;
+			break;
+		}
+
+		g_string_erase (serv->sendbuf, 0, sent);
+	}
+
+	if (serv->send_wtag)
+	{
+		fe_input_remove (serv->send_wtag);
+		serv->send_wtag = 0;
+	}
+
+	return ret;
+}
+
+static gboolean
+server_send_writable (GIOChannel *source, GIOCondition condition, server *serv)
+{
+	server_send_flush (serv);
+	return TRUE;
+}
+
+static int
+server_send_resume (server *serv)
+{
+	serv->send_tag = 0;
+	server_send_flush (serv);
+	return 0;
+}
+
 static int
 server_send_real (server *serv, char *buf, int len)
 {
+	gchar *buf_encoded = NULL;
+	gsize buf_encoded_len = len;
+
 	fe_add_rawlog (serv, buf, len, TRUE);
 
 	url_check_line (buf);
 
-	return tcp_send_real (serv->ssl, serv->sok, serv->write_converter, buf, len);
+	/* valid UTF-8 going to a UTF-8 server needs no conversion */
+	if (strcmp (serv->encoding, "UTF-8") || !text_validate_utf8 (buf, len, NULL))
+		buf = buf_encoded = text_convert_invalid (buf, len, serv->write_converter, arbitrary_encoding_fallback_string, &buf_encoded_len);
+
+	/* a full sendbuf goes out first, unless the socket is still busy with it */
+	if (serv->sendbuf->len + buf_encoded_len > SENDBUF_MAX && !serv->send_wtag &&
+		 server_send_flush (serv) < 0)
+	{
+		g_free (buf_encoded);
+		return -1;
+	}
+	g_string_append_len (serv->sendbuf, buf, buf_encoded_len);
+	g_free (buf_encoded);
+
+	if (!serv->send_tag && !serv->send_wtag)
+		serv->send_tag = fe_timeout_add (0, server_send_resume, serv);
+
+	return buf_encoded_len;
+}
+
+static void
+sendq_push (struct sendq *q, char *buf, int len)
+{
+	struct sendq_line *ring;
+	int i;
+
+	if (q->count == q->size)
+	{
+		/* unroll into a ring twice the size */
+		ring = g_new (struct sendq_line, q->size ? q->size * 2 : 16);
+		for (i = 0; i < q->count; i++)
+			ring[i] = q->ring[(q->head + i) & (q->size - 1)];
+		g_free (q->ring);
+		q->ring = ring;
+		q->size = q->size ? q->size * 2 : 16;
+		q->head = 0;
+	}
+
+	ring = &q->ring[(q->head + q->count) & (q->size - 1)];
+	ring->buf = buf;
+	ring->len = len;
+	q->count++;
+}
+
+static void
+sendq_pop (struct sendq *q)
+{
+	g_free (q->ring[q->head].buf);
+	q->head = (q->head + 1) & (q->size - 1);
+	q->count--;
+}
+
+static void
+sendq_clear (struct sendq *q)
+{
+	while (q->count)
+		sendq_pop (q);
+	g_free (q->ring);
+	memset (q, 0, sizeof (*q));
+}
+
+/* lines waiting in the send queue; sendq_len counts bytes, and an empty
+   line still has to keep its place */
+int
+tcp_send_queue_lines (server *serv)
+{
+	return serv->outbound_queue[0].count + serv->outbound_queue[1].count +
+			 serv->outbound_queue[2].count;
 }
 
 /* new throttling system, uses the same method as the Undernet
    ircu2.10 server; under test, a 200-line paste didn't flood
-   off the client */
+   off the client. It is a token bucket: each line costs the network's
+   throttle delay (plus a bit per 240 bytes), the bucket holds burst
+   lines' worth, and it refills in real time. */
+
+/* a minute without complaints from the server takes 25% off the slowdown */
+#define THROTTLE_RECOVER_USEC (60 * G_USEC_PER_SEC)
+
+static void
+server_throttle_recover (server *serv, gint64 now)
+{
+	gint64 steps;
+
+	if (serv->throttle_slowdown <= 100)
+		return;
+
+	steps = (now - serv->throttle_calm) / THROTTLE_RECOVER_USEC;
+	if (steps > 0)
+	{
+		serv->throttle_slowdown = MAX (100, serv->throttle_slowdown - MIN (steps, 12) * 25);
+		serv->throttle_calm += steps * THROTTLE_RECOVER_USEC;
+	}
+}
+
+static void
+server_throttle_profile (server *serv, gint64 *delay, gint64 *capacity)
+{
+	ircnet *net = serv->network;
+	int burst = prefs.hex_net_throttle_burst;
+	int ms = prefs.hex_net_throttle_delay;
+
+	if (net && net->throttle_burst > 0)
+		burst = net->throttle_burst;
+	if (net && net->throttle_delay > 0)
+		ms = net->throttle_delay;
+
+	*delay = (gint64) MAX (ms, 1) * serv->throttle_slowdown * 10;	/* usecs */
+	*capacity = *delay * MAX (burst, 1);
+}
 
 static int
+tcp_send_queue_resume (server *serv)
+{
+	serv->sendq_tag = 0;
+	tcp_send_queue (serv);
+	return 0;
+}
+
+static void
 tcp_send_queue (server *serv)
 {
+	struct sendq *q;
 	char *buf, *p;
 	int len, i, pri;
-	GSList *list;
-	time_t now = time (0);
+	gint64 delay, capacity;
+	gint64 now = g_get_monotonic_time ();
 
 	/* did the server close since the timeout was added? */
 	if (!is_server (serv))
-		return 0;
+		return;
+
+	server_throttle_recover (serv, now);
+	server_throttle_profile (serv, &delay, &capacity);
 
 	/* try priority 2,1,0 */
-	pri = 2;
-	while (pri >= 0)
+	for (pri = 2; pri >= 0; pri--)
 	{
-		list = serv->outbound_queue;
-		while (list)
+		q = &serv->outbound_queue[pri];
+		while (q->count)
 		{
-			buf = (char *) list->data;
-			if (buf[0] == pri)
-			{
-				buf++;	/* skip the priority byte */
-				len = strlen (buf);
+			buf = q->ring[q->head].buf;
+			len = q->ring[q->head].len;
 
-				if (serv->next_send < now)
-					serv->next_send = now;
-				if (serv->next_send - now >= 10)
-				{
-					/* check for clock skew */
-					if (now >= serv->prev_now)
-						return 1;		  /* don't remove the timeout handler */
-					/* it is skewed, reset to something sane */
-					serv->next_send = now;
-				}
+			if (serv->next_send < now)
+				serv->next_send = now;
+			if (serv->next_send - now >= capacity)
+			{
+				/* wake up just as the bucket has room again */
+				if (!serv->sendq_tag)
+					serv->sendq_tag = fe_timeout_add ((serv->next_send - now - capacity) / 1000 + 1,
+																 tcp_send_queue_resume, serv);
+				return;
+			}
 
-				for (p = buf, i = len; i && *p != ' '; p++, i--);
-				serv->next_send += (2 + i / 120);
-				serv->sendq_len -= len;
-				serv->prev_now = now;
-				fe_set_throttle (serv);
+			for (p = buf, i = len; i && *p != ' '; p++, i--);
+			serv->next_send += delay + i * delay / 240;
+			serv->sendq_len -= len;
+			fe_set_throttle (serv);
 
-				server_send_real (serv, buf, len);
+			server_send_real (serv, buf, len);
 
-				buf--;
-				serv->outbound_queue = g_slist_remove (serv->outbound_queue, buf);
-				g_free (buf);
-				list = serv->outbound_queue;
-			} else
-			{
-				list = list->next;
-			}
+			sendq_pop (q);
 		}
-		/* now try pri 0 */
-		pri--;
 	}
-	return 0;						  /* remove the timeout handler */
+}
+
+/* the server complained about flooding: slow this server's queue down.
+   Excess Flood means we got disconnected and backs off harder than a
+   RPL_TRYAGAIN, which also empties the bucket. server_throttle_recover
+   eases it off again once the server has been quiet for a while. */
+void
+server_throttle_backoff (server *serv, gboolean disconnected)
+{
+	gint64 delay, capacity;
+
+	if (disconnected)
+		serv->throttle_slowdown = serv->throttle_slowdown * 3 / 2;
+	else
+	{
+		serv->throttle_slowdown += 25;
+		server_throttle_profile (serv, &delay, &capacity);
+		serv->next_send = MAX (serv->next_send, g_get_monotonic_time () + capacity);
+	}
+	serv->throttle_slowdown = MIN (serv->throttle_slowdown, 400);
+	serv->throttle_calm = g_get_monotonic_time ();
 }
 
 int
 tcp_send_len (server *serv, char *buf, int len)
 {
 	char *dbuf;
-	int noqueue = !serv->outbound_queue;
+	int pri = 2;	/* pri 2 for most things */
 
 	if (!prefs.hex_net_throttle)
 		return server_send_real (serv, buf, len);
 
-	dbuf = g_malloc (len + 2);	/* first byte is the priority */
-	dbuf[0] = 2;	/* pri 2 for most things */
-	memcpy (dbuf + 1, buf, len);
-	dbuf[len + 1] = 0;
+	dbuf = g_malloc (len + 1);
+	memcpy (dbuf, buf, len);
+	dbuf[len] = 0;
 
 	/* privmsg and notice get a lower priority */
-	if (g_ascii_strncasecmp (dbuf + 1, "PRIVMSG", 7) == 0 ||
-		 g_ascii_strncasecmp (dbuf + 1, "NOTICE", 6) == 0)
+	if (g_ascii_strncasecmp (dbuf, "PRIVMSG", 7) == 0 ||
+		 g_ascii_strncasecmp (dbuf, "NOTICE", 6) == 0)
 	{
-		dbuf[0] = 1;
+		pri = 1;
 	}
 	else
 	{
 		/* WHO gets the lowest priority */
-		if (g_ascii_strncasecmp (dbuf + 1, "WHO ", 4) == 0)
-			dbuf[0] = 0;
+		if (g_ascii_strncasecmp (dbuf, "WHO ", 4) == 0)
+			pri = 0;
 		/* as do MODE queries (but not changes) */
-		else if (g_ascii_strncasecmp (dbuf + 1, "MODE ", 5) == 0)
+		else if (g_ascii_strncasecmp (dbuf, "MODE ", 5) == 0)
 		{
 			char *mode_str, *mode_str_end, *loc;
 			/* skip spaces before channel/nickname */
-			for (mode_str = dbuf + 5; *mode_str == ' '; ++mode_str);
+			for (mode_str = dbuf + 4; *mode_str == ' '; ++mode_str);
 			/* skip over channel/nickname */
 			mode_str = strchr (mode_str, ' ');
 			if (mode_str)
@@ -227,17 +426,16 @@ tcp_send_len (server *serv, char *buf, int len)
 				if (loc && (!mode_str_end || loc < mode_str_end))
 					goto keep_priority;
 			}
-			dbuf[0] = 0;
+			pri = 0;
 keep_priority:
 			;
 		}
 	}
 
-	serv->outbound_queue = g_slist_append (serv->outbound_queue, dbuf);
-	serv->sendq_len += len; /* tcp_send_queue uses strlen */
+	sendq_push (&serv->outbound_queue[pri], dbuf, len);
+	serv->sendq_len += len;
 
-	if (tcp_send_queue (serv) && noqueue)
-		fe_timeout_add (500, tcp_send_queue, serv);
+	tcp_send_queue (serv);
 
 	return 1;
 }
@@ -282,17 +480,155 @@ static void
 server_inline (server *serv, char *line, gssize len)
 {
 	gsize len_utf8;
+	char *conv = NULL;
+
 	if (!strcmp (serv->encoding, "UTF-8"))
-		line = text_fixup_invalid_utf8 (line, len, &len_utf8);
+	{
+		/* nearly everything is valid already, only copy when it isn't */
+		if (!text_validate_utf8 (line, len, &len_utf8))
+			line = conv = text_fixup_invalid_utf8 (line, len, &len_utf8);
+	}
 	else
-		line = text_convert_invalid (line, len, serv->read_converter, unicode_fallback_string, &len_utf8);
+		line = conv = text_convert_invalid (line, len, serv->read_converter, unicode_fallback_string, &len_utf8);
 
 	fe_add_rawlog (serv, line, len_utf8, FALSE);
 
 	/* let proto-irc.c handle it */
 	serv->p_inline (serv, line, len_utf8);
 
-	g_free (line);
+	g_free (conv);
+}
+
+/* append a partial line to serv->linebuf, dropping any \r */
+
+static void
+server_linebuf_append (server *serv, const char *buf, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (buf[i] == '\r')
+			continue;
+
+		if (serv->pos >= (sizeof (serv->linebuf) - 1))
+		{
+			fprintf (stderr,
+						"*** HEXCHAT WARNING: Buffer overflow - non-compliant server!\n");
+			return;
+		}
+		serv->linebuf[serv->pos++] = buf[i];
+	}
+}
+
+/* split received data into lines. Complete lines are handed to server_inline()
+   in place (the \r\n is overwritten with a NUL), so buf must be writable.
+   Only a trailing partial line is copied into serv->linebuf. Stops once
+   *budget lines have been handled and returns the number of bytes used. */
+
+static int
+server_read_lines (server *serv, char *buf, int len, int *budget)
+{
+	char *p = buf;
+	char *end = buf + len;
+	char *eol, *cr, *dst;
+	int line_len;
+
+	while (p < end && *budget > 0)
+	{
+		eol = memchr (p, '\n', end - p);
+		if (!eol)
+		{
+			server_linebuf_append (serv, p, end - p);
+			return len;
+		}
+
+		(*budget)--;
+
+		if (serv->pos)
+		{
+			/* finish the line left over from the previous read */
+			server_linebuf_append (serv, p, eol - p);
+			serv->linebuf[serv->pos] = 0;
+			server_inline (serv, serv->linebuf, serv->pos);
+			serv->pos = 0;
+			p = eol + 1;
+			continue;
+		}
+
+		line_len = eol - p;
+		if (line_len && p[line_len - 1] == '\r')
+			line_len--;
+
+		/* stray \r inside a line, squeeze it out like the old loop did */
+		cr = memchr (p, '\r', line_len);
+		if (cr)
+		{
+			for (dst = cr; cr < p + line_len; cr++)
+			{
+				if (*cr != '\r')
+					*dst++ = *cr;
+			}
+			line_len = dst - p;
+		}
+
+		if (line_len >= sizeof (serv->linebuf))
+		{
+			fprintf (stderr,
+						"*** HEXCHAT WARNING: Buffer overflow - non-compliant server!\n");
+			line_len = sizeof (serv->linebuf) - 1;
+		}
+
+		p[line_len] = 0;
+		server_inline (serv, p, line_len);
+		p = eol + 1;
+	}
+
+	return p - buf;
+}
+
+static gboolean
+server_read_resume (server *serv)
+{
+	serv->read_tag = 0;
+	server_read (NULL, 0, serv);
+
+	return 0;
+}
+
+/* handle what is left in serv->recvbuf. Returns FALSE when the budget ran out,
+   in which case we come back from the main loop so other servers and the UI
+   get a turn. */
+
+static gboolean
+server_read_drain (server *serv, int *budget)
+{
+	int used;
+
+	if (serv->recv_len && *budget > 0)
+	{
+		used = server_read_lines (serv, serv->recvbuf + serv->recv_start,
+										  serv->recv_len, budget);
+		/* server_cleanup() empties the buffer if a line disconnected us */
+		if (serv->recv_len)
+		{
+			serv->recv_start += used;
+			serv->recv_len -= used;
+		}
+	}
+
+	/* everything irc_inline() allocated for this batch is done with */
+	arena_reset (serv->scratch);
+
+	if (*budget > 0)
+		return TRUE;
+
+	/* SSL may hold decrypted data the socket watch won't tell us about,
+	   so resume even if recvbuf is empty */
+	if (!serv->read_tag && serv->connected)
+		serv->read_tag = fe_timeout_add (0, server_read_resume, serv);
+
+	return FALSE;
 }
 
 /* read data from socket */
@@ -301,18 +637,23 @@ static gboolean
 server_read (GIOChannel *source, GIOCondition condition, server *serv)
 {
 	int sok = serv->sok;
-	int error, i, len;
-	char lbuf[2050];
+	int error, len;
+	int budget = prefs.hex_net_read_lines > 0 ? prefs.hex_net_read_lines : G_MAXINT;
+
+	/* lines left over from the last wakeup go first */
+	if (!server_read_drain (serv, &budget))
+		return TRUE;
 
 	while (1)
 	{
+		/* recvbuf is always empty at this point */
 #ifdef USE_OPENSSL
 		if (!serv->ssl)
 #endif
-			len = recv (sok, lbuf, sizeof (lbuf) - 2, 0);
+			len = recv (sok, serv->recvbuf, serv->recvbuf_size, 0);
 #ifdef USE_OPENSSL
 		else
-			len = _SSL_recv (serv->ssl, lbuf, sizeof (lbuf) - 2);
+			len = _SSL_recv (serv->ssl, serv->recvbuf, serv->recvbuf_size);
 #endif
 		if (len < 1)
 		{
@@ -341,39 +682,28 @@ server_read (GIOChannel *source, GIOCondition condition, server *serv)
 			return TRUE;
 		}
 
-		i = 0;
-
-		lbuf[len] = 0;
-
-		while (i < len)
-		{
-			switch (lbuf[i])
-			{
-			case '\r':
-				break;
+		serv->recv_start = 0;
+		serv->recv_len = len;
 
-			case '\n':
-				serv->linebuf[serv->pos] = 0;
-				server_inline (serv, serv->linebuf, serv->pos);
-				serv->pos = 0;
-				break;
-
-			default:
-				serv->linebuf[serv->pos] = lbuf[i];
-				if (serv->pos >= (sizeof (serv->linebuf) - 1))
-					fprintf (stderr,
-								"*** HEXCHAT WARNING: Buffer overflow - non-compliant server!\n");
-				else
-					serv->pos++;
-			}
-			i++;
-		}
+		if (!server_read_drain (serv, &budget))
+			return TRUE;
 	}
 }
 
 static void
 server_connected (server * serv)
 {
+	int size = CLAMP (prefs.hex_net_recv_buffer, 4, 4096) * 1024;
+
+	if (size != serv->recvbuf_size)
+	{
+		g_free (serv->recvbuf);
+		serv->recvbuf = g_malloc (size);
+		serv->recvbuf_size = size;
+	}
+	serv->recv_start = 0;
+	serv->recv_len = 0;
+
 	prefs.wait_on_exit = TRUE;
 	serv->ping_recv = time (0);
 	serv->lag_sent = 0;
@@ -757,7 +1087,14 @@ auto_reconnect (server *serv, int send_quit, int err)
 static void
 server_flush_queue (server *serv)
 {
-	list_free (&serv->outbound_queue);
+	if (serv->sendq_tag)
+	{
+		fe_timeout_remove (serv->sendq_tag);
+		serv->sendq_tag = 0;
+	}
+	sendq_clear (&serv->outbound_queue[0]);
+	sendq_clear (&serv->outbound_queue[1]);
+	sendq_clear (&serv->outbound_queue[2]);
 	serv->sendq_len = 0;
 	fe_set_throttle (serv);
 }
@@ -925,6 +1262,21 @@ server_cleanup (server * serv)
 {
 	fe_set_lag (serv, 0);
 
+	/* whatever was sent before the disconnect (QUIT) still goes out */
+	if (serv->connected)
+		server_send_flush (serv);
+	else if (serv->send_tag)
+	{
+		fe_timeout_remove (serv->send_tag);
+		serv->send_tag = 0;
+	}
+	if (serv->send_wtag)
+	{
+		fe_input_remove (serv->send_wtag);
+		serv->send_wtag = 0;
+	}
+	g_string_truncate (serv->sendbuf, 0);
+
 	if (serv->iotag)
 	{
 		fe_input_remove (serv->iotag);
@@ -937,6 +1289,14 @@ server_cleanup (server * serv)
 		serv->joindelay_tag = 0;
 	}
 
+	if (serv->read_tag)
+	{
+		fe_timeout_remove (serv->read_tag);
+		serv->read_tag = 0;
+	}
+	serv->recv_start = 0;
+	serv->recv_len = 0;
+
 #ifdef USE_OPENSSL
 	if (serv->ssl)
 	{
@@ -1745,10 +2105,19 @@ server_new (void)
 
 	serv->id = id++;
 	serv->sok = -1;
+	serv->scratch = arena_new (16384);
+	serv->sendbuf = g_string_sized_new (1024);
+	serv->throttle_slowdown = 100;
+	serv->chan_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	serv->dialog_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	serv->people = g_hash_table_new (g_str_hash, g_str_equal);
 	strcpy (serv->nick, prefs.hex_irc_nick1);
 	server_set_defaults (serv);
 
 	serv_list = g_slist_prepend (serv_list, serv);
+	if (!serv_live)
+		serv_live = g_hash_table_new (g_direct_hash, g_direct_equal);
+	g_hash_table_insert (serv_live, serv, serv);
 
 	fe_new_server (serv);
 
@@ -1758,7 +2127,31 @@ server_new (void)
 int
 is_server (server *serv)
 {
-	return g_slist_find (serv_list, serv) ? 1 : 0;
+	return serv && serv_live && g_hash_table_lookup (serv_live, serv) ? 1 : 0;
+}
+
+/* 005 CASEMAPPING: pick the matching comparator and refold every
+   nick and channel key the server's tables are hashed on */
+void
+server_set_casemapping (server *serv, int casemapping)
+{
+	switch (casemapping)
+	{
+	case CASEMAP_ASCII:
+		serv->p_cmp = ascii_casecmp;
+		break;
+	case CASEMAP_STRICT_RFC1459:
+		serv->p_cmp = strict_rfc_casecmp;
+		break;
+	default:
+		serv->p_cmp = rfc_casecmp;
+	}
+
+	if (serv->casemapping == casemapping)
+		return;
+	serv->casemapping = casemapping;
+	userlist_rekey (serv);
+	session_index_rebuild (serv);
 }
 
 void
@@ -1777,6 +2170,7 @@ server_set_defaults (server *serv)
 	serv->nick_modes = g_strdup ("ohv");
 	serv->modes_per_line = 3; /* https://datatracker.ietf.org/doc/html/rfc1459#section-4.2.3.1 */
 	serv->sasl_mech = MECH_PLAIN;
+	server_set_casemapping (serv, CASEMAP_RFC1459);
 
 	if (!serv->encoding)
 		server_set_encoding (serv, "UTF-8");
@@ -1921,6 +2315,7 @@ server_free (server *serv)
 	serv->cleanup (serv);
 
 	serv_list = g_slist_remove (serv_list, serv);
+	g_hash_table_remove (serv_live, serv);
 
 	dcc_notify_kill (serv);
 	serv->flush_queue (serv);
@@ -1933,6 +2328,12 @@ server_free (server *serv)
 	g_free (serv->bad_nick_prefixes);
 	g_free (serv->last_away_reason);
 	g_free (serv->encoding);
+	g_free (serv->recvbuf);
+	arena_free (serv->scratch);
+	g_string_free (serv->sendbuf, TRUE);
+	g_hash_table_destroy (serv->chan_index);
+	g_hash_table_destroy (serv->dialog_index);
+	g_hash_table_destroy (serv->people);
 
 	g_iconv_close (serv->read_converter);
 	g_iconv_close (serv->write_converter);
@@ -26,15 +26,18 @@ extern GSList *serv_list;
 int tcp_send_len (server *serv, char *buf, int len);
 void tcp_sendf (server *serv, const char *fmt, ...) G_GNUC_PRINTF (2, 3);
 int tcp_send_real (void *ssl, int sok, GIConv write_converter, char *buf, int len);
+int tcp_send_queue_lines (server *serv);
 
 server *server_new (void);
 int is_server (server *serv);
 void server_fill_her_up (server *serv);
 void server_set_encoding (server *serv, char *new_encoding);
+void server_set_casemapping (server *serv, int casemapping);
 void server_set_defaults (server *serv);
 char *server_get_network (server *serv, gboolean fallback);
 void server_set_name (server *serv, char *name);
 void server_free (server *serv);
+void server_throttle_backoff (server *serv, gboolean disconnected);
 
 void server_away_save_message (server *serv, char *nick, char *msg);
 struct away_msg *server_away_find_message (server *serv, char *nick);
@@ -1025,6 +1025,9 @@ servlist_load (void)
 			case 'D':
 				net->selected = atoi (buf + 2);
 				break;
+			case 'Q':
+				sscanf (buf + 2, "%d,%d", &net->throttle_burst, &net->throttle_delay);
+				break;
 			/* FIXME Migration code. In 2.9.5 the order was:
 			 *
 			 * P=serverpass, A=saslpass, B=nickservpass
@@ -1165,6 +1168,8 @@ servlist_save (void)
 		}
 
 		fprintf (fp, "F=%d\nD=%d\n", net->flags, net->selected);
+		if (net->throttle_burst || net->throttle_delay)
+			fprintf (fp, "Q=%d,%d\n", net->throttle_burst, net->throttle_delay);
 
 		netlist = net->servlist;
 		while (netlist)
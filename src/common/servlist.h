@@ -51,6 +51,8 @@ typedef struct ircnet
 	GSList *favchanlist;
 	int selected;
 	guint32 flags;
+	int throttle_burst;		/* 0 = use net_throttle_burst */
+	int throttle_delay;		/* 0 = use net_throttle_delay */
 } ircnet;
 
 extern GSList *network_list;
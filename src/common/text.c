@@ -21,6 +21,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -69,8 +70,52 @@ static ca_context *ca_con;
 static void mkdir_p (char *filename);
 static char *log_create_filename (char *channame);
 
+/* Scrollback is kept in a ring file per channel. It is memory-mapped,
+   and once it exists its size never changes:
+
+   struct scrollback_header
+   records, oldest at head, wrapping at the end of the data area:
+      guint32 len, gint64 stamp, len bytes of UTF-8 text, guint32 len
+
+   The length at both ends lets the ring be walked from either end.
+   Appending drops the oldest records until the new one fits, so adding
+   and trimming are both O(1) per line. Opening a tab replays only as
+   many of the newest lines as fe_replay_start asks for, walking back
+   from the tail; older records are handed to the front end by
+   scrollback_load_older as the user scrolls up. The old
+   "T <stamp> <text>" .txt files are read in and removed the first time
+   a ring is created. */
+
+#define SCROLLBACK_MAGIC "HXSBRING"
+#define SCROLLBACK_VERSION 1
+#define SCROLLBACK_REC_OVERHEAD (4 + 8 + 4)
+#define SCROLLBACK_RING_MIN (64 * 1024)
+#define SCROLLBACK_RING_MAX (4 * 1024 * 1024)
+
+struct scrollback_header
+{
+	char magic[8];
+	guint32 version;
+	guint32 size;				/* bytes in the ring after this header */
+	guint32 head;				/* offset of the oldest record */
+	guint32 used;				/* bytes of records from head on */
+	guint32 count;				/* records in the ring */
+	guint32 reserved[9];		/* pads the header to 64 bytes */
+};
+
+struct scrollback
+{
+	int fd;
+	char *map;
+	gsize map_len;
+	struct scrollback_header *hdr;
+	char *data;					/* the ring itself, hdr->size bytes */
+	guint32 older;				/* records before the replayed ones */
+	guint32 older_end;			/* offset of the oldest replayed record */
+};
+
 static char *
-scrollback_get_filename (session *sess)
+scrollback_get_filename (session *sess, const char *ext)
 {
 	char *net, *chan, *buf, *ret = NULL;
 
@@ -79,13 +124,13 @@ scrollback_get_filename (session *sess)
 		return NULL;
 
 	net = log_create_filename (net);
-	buf = g_strdup_printf ("%s" G_DIR_SEPARATOR_S "scrollback" G_DIR_SEPARATOR_S "%s" G_DIR_SEPARATOR_S "%s.txt", get_xdir (), net, "");
+	buf = g_strdup_printf ("%s" G_DIR_SEPARATOR_S "scrollback" G_DIR_SEPARATOR_S "%s" G_DIR_SEPARATOR_S "%s.%s", get_xdir (), net, "", ext);
 	mkdir_p (buf);
 	g_free (buf);
 
 	chan = log_create_filename (sess->channel);
 	if (chan[0])
-		buf = g_strdup_printf ("%s" G_DIR_SEPARATOR_S "scrollback" G_DIR_SEPARATOR_S "%s" G_DIR_SEPARATOR_S "%s.txt", get_xdir (), net, chan);
+		buf = g_strdup_printf ("%s" G_DIR_SEPARATOR_S "scrollback" G_DIR_SEPARATOR_S "%s" G_DIR_SEPARATOR_S "%s.%s", get_xdir (), net, chan, ext);
 	else
 		buf = NULL;
 	g_free (chan);
@@ -100,250 +145,457 @@ scrollback_get_filename (session *sess)
 	return ret;
 }
 
-void
-scrollback_close (session *sess)
+static int
+scrollback_max_lines (void)
 {
-	g_clear_object (&sess->scrollfile);
+	if (prefs.hex_text_max_lines > 0)
+		return MIN (prefs.hex_text_max_lines, SCROLLBACK_MAX);
+	return SCROLLBACK_MAX;
 }
 
-/* shrink the file to roughly prefs.hex_text_max_lines */
+static void
+ring_put (struct scrollback *sb, guint32 off, const void *src, guint32 len)
+{
+	guint32 first = MIN (len, sb->hdr->size - off);
+
+	memcpy (sb->data + off, src, first);
+	memcpy (sb->data, (const char *) src + first, len - first);
+}
 
 static void
-scrollback_shrink (session *sess)
+ring_get (struct scrollback *sb, guint32 off, void *dst, guint32 len)
 {
-	char *buf, *p;
-	gsize len;
-	gint offset, lines = 0;
-	const gint max_lines = MIN(prefs.hex_text_max_lines, SCROLLBACK_MAX);
+	guint32 first = MIN (len, sb->hdr->size - off);
 
-	if (!g_file_load_contents (sess->scrollfile, NULL, &buf, &len, NULL, NULL))
-		return;
+	memcpy (dst, sb->data + off, first);
+	memcpy ((char *) dst + first, sb->data, len - first);
+}
+
+static guint32
+ring_offset (struct scrollback *sb, guint32 off, guint32 add)
+{
+	return (guint32) (((guint64) off + add) % sb->hdr->size);
+}
 
-	/* count all lines */
-	p = buf;
-	while (p != buf + len)
+/* offset of the record that ends at off, G_MAXUINT32 if the ring is corrupt */
+static guint32
+ring_prev (struct scrollback *sb, guint32 off, guint32 *len)
+{
+	ring_get (sb, ring_offset (sb, off, sb->hdr->size - 4), len, 4);
+	if (*len > sb->hdr->used - SCROLLBACK_REC_OVERHEAD)
 	{
-		if (*p == '\n')
-			lines++;
-		p++;
+		g_warning ("Corrupt scrollback file");
+		*len = 0;
+		return G_MAXUINT32;
 	}
+	return ring_offset (sb, off, sb->hdr->size - SCROLLBACK_REC_OVERHEAD - *len);
+}
+
+static char *
+ring_read (struct scrollback *sb, guint32 off, guint32 len, time_t *stamp)
+{
+	gint64 stamp64;
+	char *text;
+
+	ring_get (sb, ring_offset (sb, off, 4), &stamp64, 8);
+	*stamp = stamp64;
+	text = g_malloc (len + 1);
+	ring_get (sb, ring_offset (sb, off, 12), text, len);
+	text[len] = 0;
+	return text;
+}
+
+static void
+scrollback_append (struct scrollback *sb, time_t stamp, const char *text, guint32 len)
+{
+	struct scrollback_header *hdr = sb->hdr;
+	gint64 stamp64 = stamp;
+	guint32 need, oldlen;
+	int max_lines = scrollback_max_lines ();
+
+	/* one line can't take more than a quarter of the ring; cut it
+	   where a character starts */
+	if (len > hdr->size / 4)
+	{
+		const char *cut = g_utf8_find_prev_char (text, text + hdr->size / 4 + 1);
 
-	offset = lines - max_lines;
+		len = cut ? cut - text : hdr->size / 4;
+	}
+	need = SCROLLBACK_REC_OVERHEAD + len;
 
-	/* now just go back to where we want to start the file */
-	p = buf;
-	lines = 0;
-	while (p != buf + len)
+	while (hdr->count && (hdr->size - hdr->used < need || hdr->count >= max_lines))
 	{
-		if (*p == '\n')
+		ring_get (sb, hdr->head, &oldlen, 4);
+		hdr->head = ring_offset (sb, hdr->head, SCROLLBACK_REC_OVERHEAD + oldlen);
+		hdr->used -= SCROLLBACK_REC_OVERHEAD + oldlen;
+		hdr->count--;
+		if (sb->older)
+			sb->older--;
+	}
+	if (!hdr->count)
+		hdr->head = hdr->used = 0;
+
+	{
+		guint32 off = ring_offset (sb, hdr->head, hdr->used);
+
+		ring_put (sb, off, &len, 4);
+		ring_put (sb, ring_offset (sb, off, 4), &stamp64, 8);
+		ring_put (sb, ring_offset (sb, off, 12), text, len);
+		ring_put (sb, ring_offset (sb, off, 12 + len), &len, 4);
+	}
+
+	/* the record is in place before the header counts it */
+	hdr->used += need;
+	hdr->count++;
+}
+
+static void
+scrollback_reset (struct scrollback *sb, guint32 size)
+{
+	memset (sb->hdr, 0, sizeof (struct scrollback_header));
+	memcpy (sb->hdr->magic, SCROLLBACK_MAGIC, sizeof (sb->hdr->magic));
+	sb->hdr->version = SCROLLBACK_VERSION;
+	sb->hdr->size = size;
+}
+
+static gboolean
+scrollback_valid (struct scrollback *sb)
+{
+	struct scrollback_header *hdr = sb->hdr;
+
+	return memcmp (hdr->magic, SCROLLBACK_MAGIC, sizeof (hdr->magic)) == 0 &&
+			 hdr->version == SCROLLBACK_VERSION &&
+			 hdr->size == sb->map_len - sizeof (struct scrollback_header) &&
+			 hdr->head < hdr->size && hdr->used <= hdr->size &&
+			 (hdr->count == 0) == (hdr->used == 0);
+}
+
+/* copy an old text scrollback file into a new ring, then delete it */
+static void
+scrollback_migrate (session *sess, struct scrollback *sb)
+{
+	char *path, *buf, *line, *eol, *next, *text;
+	gsize len;
+	time_t stamp;
+
+	if ((path = scrollback_get_filename (sess, "txt")) == NULL)
+		return;
+
+	if (g_file_get_contents (path, &buf, &len, NULL))
+	{
+		for (line = buf; line < buf + len; line = next)
 		{
-			lines++;
-			if (lines == offset)
+			eol = memchr (line, '\n', buf + len - line);
+			if (!eol)
+				eol = buf + len;
+			next = eol + 1;
+			*eol = 0;
+			if (eol > line && eol[-1] == '\r')
+				eol[-1] = 0;
+
+			if (!g_utf8_validate (line, -1, NULL))
+				continue;
+
+			stamp = 0;
+			text = line;
+			if (line[0] == 'T' && line[1] == ' ')
 			{
-				p++;
-				break;
+				stamp = g_ascii_strtoull (line + 2, NULL, 10);
+				if (stamp == 0)
+					continue;
+				text = strchr (line + 3, ' ');
+				text = text ? text + 1 : "";
 			}
+			scrollback_append (sb, stamp, text, strlen (text));
 		}
-		p++;
+		g_free (buf);
+		g_unlink (path);
 	}
 
-	if (g_file_replace_contents (sess->scrollfile, p, strlen(p), NULL, FALSE,
-							G_FILE_CREATE_PRIVATE, NULL, NULL, NULL))
-		sess->scrollwritten = lines;
+	g_free (path);
+}
 
-	g_free (buf);
+static void
+scrollback_unmap (struct scrollback *sb)
+{
+#ifndef WIN32
+	munmap (sb->map, sb->map_len);
+#else
+	UnmapViewOfFile (sb->map);
+#endif
 }
 
 static void
-scrollback_save (session *sess, char *text, time_t stamp)
+scrollback_free (struct scrollback *sb)
 {
-	GOutputStream *ostream;
-	char *buf;
+	scrollback_unmap (sb);
+	close (sb->fd);
+	g_free (sb);
+}
 
-	if (sess->type == SESS_SERVER && prefs.hex_gui_tab_server == 1)
-		return;
+static gsize
+scrollback_ring_size (void)
+{
+	return CLAMP ((gsize) scrollback_max_lines () * 128, SCROLLBACK_RING_MIN, SCROLLBACK_RING_MAX);
+}
 
-	if (sess->text_scrollback == SET_DEFAULT)
+/* map an existing ring file, or with create a new empty one of size bytes */
+static struct scrollback *
+scrollback_map (const char *path, gsize size, gboolean create)
+{
+	struct scrollback *sb;
+	struct stat st;
+	int fd;
+
+	fd = g_open (path, O_RDWR | (create ? O_CREAT | O_TRUNC : 0) | OFLAGS, 0600);
+	if (fd == -1)
+		return NULL;
+
+	if (create)
 	{
-		if (!prefs.hex_text_replay)
-			return;
+#ifdef WIN32
+		if (_chsize (fd, sizeof (struct scrollback_header) + size) != 0)
+#else
+		if (ftruncate (fd, sizeof (struct scrollback_header) + size) != 0)
+#endif
+		{
+			close (fd);
+			return NULL;
+		}
 	}
 	else
 	{
-		if (sess->text_scrollback != SET_ON)
-			return;
+		if (fstat (fd, &st) != 0 ||
+			 st.st_size < (off_t) sizeof (struct scrollback_header) + SCROLLBACK_RING_MIN)
+		{
+			close (fd);
+			return NULL;
+		}
+		size = st.st_size - sizeof (struct scrollback_header);
 	}
 
-	if (!sess->scrollfile)
+	sb = g_new0 (struct scrollback, 1);
+	sb->fd = fd;
+	sb->map_len = sizeof (struct scrollback_header) + size;
+#ifndef WIN32
+	sb->map = mmap (NULL, sb->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (sb->map == MAP_FAILED)
+		sb->map = NULL;
+#else
 	{
-		if ((buf = scrollback_get_filename (sess)) == NULL)
-			return;
+		HANDLE mapping = CreateFileMapping ((HANDLE) _get_osfhandle (fd), NULL, PAGE_READWRITE, 0, 0, NULL);
 
-		sess->scrollfile = g_file_new_for_path (buf);
-		g_free (buf);
+		if (mapping)
+		{
+			sb->map = MapViewOfFile (mapping, FILE_MAP_WRITE, 0, 0, sb->map_len);
+			CloseHandle (mapping);
+		}
 	}
-	else
+#endif
+	if (!sb->map)
 	{
-		/* Users can delete the folder after it's created... */
-		GFile *parent = g_file_get_parent (sess->scrollfile);
-		g_file_make_directory_with_parents (parent, NULL, NULL);
-		g_object_unref (parent);
+		close (fd);
+		g_free (sb);
+		return NULL;
 	}
+	sb->hdr = (struct scrollback_header *) sb->map;
+	sb->data = sb->map + sizeof (struct scrollback_header);
 
-	ostream = G_OUTPUT_STREAM(g_file_append_to (sess->scrollfile, G_FILE_CREATE_PRIVATE, NULL, NULL));
-	if (!ostream)
-		return;
-
-	if (!stamp)
-		stamp = time(0);
-	if (sizeof (stamp) == 4)	/* gcc will optimize one of these out */
-		buf = g_strdup_printf ("T %d ", (int) stamp);
-	else
-		buf = g_strdup_printf ("T %" G_GINT64_FORMAT " ", (gint64)stamp);
-
-	g_output_stream_write (ostream, buf, strlen (buf), NULL, NULL);
-	g_output_stream_write (ostream, text, strlen (text), NULL, NULL);
-	if (!g_str_has_suffix (text, "\n"))
-		g_output_stream_write (ostream, "\n", 1, NULL, NULL);
+	if (create)
+		scrollback_reset (sb, size);
 
-	g_free (buf);
-	g_object_unref (ostream);
+	return sb;
+}
 
-	sess->scrollwritten++;
+/* append every record of src to dst, oldest first */
+static void
+scrollback_copy (struct scrollback *dst, struct scrollback *src)
+{
+	guint32 off = src->hdr->head, len, i;
+	time_t stamp;
+	char *text;
 
-	if ((sess->scrollwritten > prefs.hex_text_max_lines && prefs.hex_text_max_lines > 0) ||
-       sess->scrollwritten > SCROLLBACK_MAX)
-		scrollback_shrink (sess);
+	for (i = 0; i < src->hdr->count; i++)
+	{
+		ring_get (src, off, &len, 4);
+		if (len > src->hdr->used)
+			break;
+		text = ring_read (src, off, len, &stamp);
+		scrollback_append (dst, stamp, text, len);
+		g_free (text);
+		off = ring_offset (src, off, SCROLLBACK_REC_OVERHEAD + len);
+	}
 }
 
-void
-scrollback_load (session *sess)
+static struct scrollback *
+scrollback_open (session *sess)
 {
-	GInputStream *stream;
-	GDataInputStream *istream;
-	gchar *buf, *text;
-	gint lines = 0;
-	time_t stamp = 0;
+	struct scrollback *sb, *ring;
+	char *path, *tmp;
+	gsize size = scrollback_ring_size ();
 
-	if (sess->text_scrollback == SET_DEFAULT)
+	if ((path = scrollback_get_filename (sess, "ring")) == NULL)
+		return NULL;
+
+	sb = scrollback_map (path, 0, FALSE);
+	if (sb && scrollback_valid (sb) && sb->hdr->size == size)
 	{
-		if (!prefs.hex_text_replay)
-			return;
+		g_free (path);
+		return sb;
 	}
-	else
+
+	/* missing, damaged or sized for another text_max_lines: build the
+	   ring it should be next to it, then swap it in */
+	tmp = g_strconcat (path, ".new", NULL);
+	ring = scrollback_map (tmp, size, TRUE);
+	if (!ring)
 	{
-		if (sess->text_scrollback != SET_ON)
-			return;
+		if (sb && !scrollback_valid (sb))
+			scrollback_reset (sb, sb->map_len - sizeof (struct scrollback_header));
+		g_free (tmp);
+		g_free (path);
+		return sb;
 	}
 
-	if (!sess->scrollfile)
+	if (!sb)
+		scrollback_migrate (sess, ring);
+	else
 	{
-		if ((buf = scrollback_get_filename (sess)) == NULL)
-			return;
+		if (scrollback_valid (sb))
+			scrollback_copy (ring, sb);
+		scrollback_free (sb);
+	}
+	scrollback_free (ring);
 
-		sess->scrollfile = g_file_new_for_path (buf);
-		g_free (buf);
+	g_unlink (path);
+	sb = g_rename (tmp, path) == 0 ? scrollback_map (path, 0, FALSE) : NULL;
+
+	g_free (tmp);
+	g_free (path);
+	return sb;
+}
+
+void
+scrollback_close (session *sess)
+{
+	if (sess->scrollback)
+	{
+		scrollback_free (sess->scrollback);
+		sess->scrollback = NULL;
 	}
+}
+
+static gboolean
+scrollback_enabled (session *sess)
+{
+	if (sess->text_scrollback == SET_DEFAULT)
+		return prefs.hex_text_replay;
+	return sess->text_scrollback == SET_ON;
+}
+
+static void
+scrollback_save (session *sess, char *text, time_t stamp)
+{
+	int len;
 
-	stream = G_INPUT_STREAM(g_file_read (sess->scrollfile, NULL, NULL));
-	if (!stream)
+	if (sess->type == SESS_SERVER && prefs.hex_gui_tab_server == 1)
 		return;
 
-	istream = g_data_input_stream_new (stream);
-	/*
-	 * This is to avoid any issues moving between windows/unix
-	 * but the docs mention an invalid \r without a following \n
-	 * can lock up the program... (Our write() always adds \n)
-	 */
-	g_data_input_stream_set_newline_type (istream, G_DATA_STREAM_NEWLINE_TYPE_ANY);
-	g_object_unref (stream);
+	if (!scrollback_enabled (sess))
+		return;
 
-	while (1)
-	{
-		GError *err = NULL;
-		gsize n_bytes;
+	if (!sess->scrollback && !(sess->scrollback = scrollback_open (sess)))
+		return;
 
-		buf = g_data_input_stream_read_line_utf8 (istream, &n_bytes, NULL, &err);
+	if (!stamp)
+		stamp = time(0);
 
-		if (!err && buf)
-		{
-			/*
-			 * Some scrollback lines have three blanks after the timestamp and a newline
-			 * Some have only one blank and a newline
-			 * Some don't even have a timestamp
-			 * Some don't have any text at all
-			 */
-			if (buf[0] == 'T' && buf[1] == ' ')
-			{
-				if (sizeof (time_t) == 4)
-					stamp = strtoul (buf + 2, NULL, 10);
-				else
-					stamp = g_ascii_strtoull (buf + 2, NULL, 10); /* in case time_t is 64 bits */
+	/* stored without the \n, the loader prints each record as a line */
+	len = strlen (text);
+	if (len && text[len - 1] == '\n')
+		len--;
+	scrollback_append (sess->scrollback, stamp, text, len);
 
-				if (G_UNLIKELY(stamp == 0))
-				{
-					g_warning ("Invalid timestamp in scrollback file");
-					continue;
-				}
+	sess->scrollwritten = sess->scrollback->hdr->count;
+}
 
-				text = strchr (buf + 3, ' ');
-				if (text && text[1])
-				{
-					text++; /* Use the text *after* the space */
+static void
+scrollback_print (session *sess, time_t stamp, char *text, gboolean older)
+{
+	char *stripped = NULL;
 
-					if (prefs.hex_text_stripcolor_replay)
-					{
-						text = strip_color (text, -1, STRIP_COLOR);
-					}
+	if (!text[0])
+		text = "  ";
+	else if (prefs.hex_text_stripcolor_replay)
+		text = stripped = strip_color (text, -1, STRIP_COLOR);
 
-					fe_print_text (sess, text, stamp, TRUE);
+	if (older)
+		fe_prepend_text (sess, text, stamp);
+	else
+		fe_print_text (sess, text, stamp, TRUE);
 
-					if (prefs.hex_text_stripcolor_replay)
-					{
-						g_free (text);
-					}
-				}
-				else
-				{
-					fe_print_text (sess, "  ", stamp, TRUE);
-				}
-			}
-			else
-			{
-				if (strlen (buf))
-					fe_print_text (sess, buf, 0, TRUE);
-				else
-					fe_print_text (sess, "  ", 0, TRUE);
-			}
-			lines++;
+	g_free (stripped);
+}
 
-			g_free (buf);
-		}
-		else if (err)
-		{
-			/* If its only an encoding error it may be specific to the line */
-			if (g_error_matches (err, G_CONVERT_ERROR, G_CONVERT_ERROR_ILLEGAL_SEQUENCE))
-			{
-				g_warning ("Invalid utf8 in scrollback file");
-				g_clear_error (&err);
-				continue;
-			}
+void
+scrollback_load (session *sess)
+{
+	struct scrollback *sb;
+	guint32 off, prev, len, count, want, n, i;
+	time_t stamp = 0;
+	char *text, *buf;
+	int lines;
 
-			/* For general errors just give up */
-			g_clear_error (&err);
-			break;
+	if (!scrollback_enabled (sess))
+		return;
+
+	if (!sess->scrollback && !(sess->scrollback = scrollback_open (sess)))
+		return;
+	sb = sess->scrollback;
+
+	/* a front end that can't page older lines in gets them all */
+	count = sb->hdr->count;
+	lines = fe_replay_start (sess);
+	want = (lines > 0 && lines < count) ? lines : count;
+
+	if (want == count)
+	{
+		off = sb->hdr->head;
+		n = count;
+	}
+	else
+	{
+		/* walk back from the tail to the first line to replay */
+		off = ring_offset (sb, sb->hdr->head, sb->hdr->used);
+		for (n = 0; n < want; n++)
+		{
+			prev = ring_prev (sb, off, &len);
+			if (prev == G_MAXUINT32)
+				break;
+			off = prev;
 		}
-		else /* No new line */
+	}
+
+	sb->older = (n < want) ? 0 : count - n;
+	sb->older_end = off;
+
+	for (i = 0; i < n; i++)
+	{
+		ring_get (sb, off, &len, 4);
+		if (len > sb->hdr->used)
 		{
+			g_warning ("Corrupt scrollback file");
 			break;
 		}
+		text = ring_read (sb, off, len, &stamp);
+		scrollback_print (sess, stamp, text, FALSE);
+		g_free (text);
+		off = ring_offset (sb, off, SCROLLBACK_REC_OVERHEAD + len);
 	}
 
-	g_object_unref (istream);
+	sess->scrollwritten = n;
 
-	sess->scrollwritten = lines;
-
-	if (lines)
+	if (n)
 	{
 		text = ctime (&stamp);
 		buf = g_strdup_printf ("\n*\t%s %s\n", _("Loaded log from"), text);
@@ -353,21 +605,39 @@ scrollback_load (session *sess)
 	}
 }
 
-void
-log_close (session *sess)
+/* Called by the front end when the user scrolls to the top. Hands it up
+   to lines older records, newest first, through fe_prepend_text and
+   returns how many there were. */
+int
+scrollback_load_older (session *sess, int lines)
 {
-	char obuf[512];
-	time_t currenttime;
+	struct scrollback *sb = sess->scrollback;
+	guint32 off, len;
+	time_t stamp;
+	char *text;
+	int n;
 
-	if (sess->logfd != -1)
+	if (!sb || !sb->older)
+		return 0;
+
+	off = sb->older_end;
+	for (n = 0; n < lines && sb->older; n++)
 	{
-		currenttime = time (NULL);
-		write (sess->logfd, obuf,
-			 g_snprintf (obuf, sizeof (obuf) - 1, _("**** ENDING LOGGING AT %s\n"),
-						  ctime (&currenttime)));
-		close (sess->logfd);
-		sess->logfd = -1;
+		off = ring_prev (sb, off, &len);
+		if (off == G_MAXUINT32)
+		{
+			sb->older = 0;
+			break;
+		}
+		text = ring_read (sb, off, len, &stamp);
+		scrollback_print (sess, stamp, text, TRUE);
+		g_free (text);
+
+		sb->older--;
+		sb->older_end = off;
 	}
+
+	return n;
 }
 
 /*
@@ -550,59 +820,376 @@ log_create_pathname (char *servname, char *channame, char *netname)
 		g_snprintf (fname, sizeof (fname), "%s" G_DIR_SEPARATOR_S "logs" G_DIR_SEPARATOR_S "%s", get_xdir (), fnametime);
 	}
 
-	/* create all the subdirectories */
-	mkdir_p (fname);
-
+	/* the writer thread creates the subdirectories */
 	return g_strdup (fname);
 }
 
-static int
-log_open_file (char *servname, char *channame, char *netname)
+/* Log files are written by a thread of their own so the UI never waits
+   on the disk. Sessions push log_ops onto a lock-free stack; the writer
+   takes the whole stack at once, puts it back in order and does one
+   write() per file for everything in it. The writer owns each struct
+   log_file, the UI only creates one and queues ops against it. */
+
+#define LOG_CHECK_INTERVAL 60	/* seconds between checks for a new log path */
+
+enum
+{
+	LOG_OP_OPEN,			/* open path, write data (the BEGIN line) */
+	LOG_OP_WRITE,			/* append data */
+	LOG_OP_CHECK,			/* reopen as path with data if it moved or vanished */
+	LOG_OP_CLOSE,			/* write data (the ENDING line), close and free */
+	LOG_OP_QUIT
+};
+
+struct log_file
 {
-	char buf[512];
 	int fd;
-	char *file;
-	time_t currenttime;
+	char *path;				/* what it was last opened as */
+	GString *pending;		/* writes from the current batch */
+	gboolean touched;		/* on the batch's list of files to flush */
+	int sync;				/* irc_log_sync as of the newest op */
+};
+
+struct log_op
+{
+	struct log_op *next;
+	int type;				/* LOG_OP_* */
+	int sync;				/* irc_log_sync when queued; prefs is the UI's */
+	struct log_file *file;
+	char *path;
+	gsize len;
+	char data[1];
+};
+
+static struct log_op *log_queue;		/* newest first */
+static GMutex log_lock;					/* only for sleeping on log_wake */
+static GCond log_wake;
+static GThread *log_thread;
+static int log_check_tag;
+static char *log_error_path;			/* set by the writer, reported by the UI */
 
-	file = log_create_pathname (servname, channame, netname);
-	if (!file)
-		return -1;
+#ifdef WIN32
+#define log_fsync(fd) _commit (fd)
+#else
+#define log_fsync(fd) fsync (fd)
+#endif
 
-	fd = g_open (file, O_CREAT | O_APPEND | O_WRONLY | OFLAGS, 0644);
-	g_free (file);
+static struct log_op *
+log_take (void)
+{
+	struct log_op *ops;
 
-	if (fd == -1)
-		return -1;
-	currenttime = time (NULL);
-	write (fd, buf,
-			 g_snprintf (buf, sizeof (buf), _("**** BEGIN LOGGING AT %s\n"),
-						  ctime (&currenttime)));
+	do
+		ops = g_atomic_pointer_get (&log_queue);
+	while (ops && !g_atomic_pointer_compare_and_exchange (&log_queue, ops, NULL));
 
-	return fd;
+	return ops;
 }
 
 static void
-log_open (session *sess)
+log_write_all (int fd, const char *buf, gsize len)
 {
-	static gboolean log_error = FALSE;
+	gssize sent;
 
-	log_close (sess);
-	sess->logfd = log_open_file (sess->server->servername, sess->channel,
-										  server_get_network (sess->server, FALSE));
+	while (len)
+	{
+		sent = write (fd, buf, len);
+		if (sent < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		buf += sent;
+		len -= sent;
+	}
+}
+
+static void
+log_file_flush (struct log_file *file)
+{
+	if (file->fd != -1 && file->pending->len)
+		log_write_all (file->fd, file->pending->str, file->pending->len);
+	g_string_truncate (file->pending, 0);
+}
+
+static void
+log_file_open (struct log_file *file, char *path, const char *begin, gsize len)
+{
+	char *dup;
 
-	if (!log_error && sess->logfd == -1)
+	if (file->fd != -1)
 	{
-		char *filename = log_create_pathname (sess->server->servername, sess->channel, server_get_network (sess->server, FALSE));
-		char *message = g_strdup_printf (_("* Can't open log file(s) for writing. Check the\npermissions on %s"), filename);
+		if (file->sync)
+			log_fsync (file->fd);
+		close (file->fd);
+	}
+	g_free (file->path);
+	file->path = g_strdup (path);
 
-		g_free (filename);
+	mkdir_p (path);
+	file->fd = g_open (path, O_CREAT | O_APPEND | O_WRONLY | OFLAGS, 0644);
+	if (file->fd == -1)
+	{
+		dup = g_strdup (path);
+		if (!g_atomic_pointer_compare_and_exchange (&log_error_path, NULL, dup))
+			g_free (dup);
+		return;
+	}
 
-		fe_message (message, FE_MSG_WAIT | FE_MSG_ERROR);
+	log_write_all (file->fd, begin, len);
+}
 
+static gpointer
+log_writer (gpointer data)
+{
+	struct log_op *ops, *op, *next;
+	struct log_file *file;
+	GSList *touched, *list;
+	gboolean quit = FALSE;
+
+	while (!quit)
+	{
+		g_mutex_lock (&log_lock);
+		while (!(ops = log_take ()))
+			g_cond_wait (&log_wake, &log_lock);
+		g_mutex_unlock (&log_lock);
+
+		/* the stack comes off newest first */
+		for (op = ops, ops = NULL; op; op = next)
+		{
+			next = op->next;
+			op->next = ops;
+			ops = op;
+		}
+
+		touched = NULL;
+		for (op = ops; op; op = next)
+		{
+			next = op->next;
+			file = op->file;
+			if (file)
+				file->sync = op->sync;
+
+			switch (op->type)
+			{
+			case LOG_OP_OPEN:
+				log_file_open (file, op->path, op->data, op->len);
+				break;
+			case LOG_OP_WRITE:
+				if (file->fd == -1)
+					break;
+				g_string_append_len (file->pending, op->data, op->len);
+				if (!file->touched)
+				{
+					file->touched = TRUE;
+					touched = g_slist_prepend (touched, file);
+				}
+				break;
+			case LOG_OP_CHECK:
+				if (file->fd == -1 || strcmp (op->path, file->path) != 0 ||
+					 g_access (op->path, F_OK) != 0)
+				{
+					log_file_flush (file);
+					log_file_open (file, op->path, op->data, op->len);
+				}
+				break;
+			case LOG_OP_CLOSE:
+				log_file_flush (file);
+				if (file->fd != -1)
+				{
+					log_write_all (file->fd, op->data, op->len);
+					if (file->sync)
+						log_fsync (file->fd);
+					close (file->fd);
+				}
+				if (file->touched)
+					touched = g_slist_remove (touched, file);
+				g_string_free (file->pending, TRUE);
+				g_free (file->path);
+				g_free (file);
+				break;
+			case LOG_OP_QUIT:
+				quit = TRUE;
+				break;
+			}
+
+			g_free (op->path);
+			g_free (op);
+		}
+
+		for (list = touched; list; list = list->next)
+		{
+			file = list->data;
+			file->touched = FALSE;
+			log_file_flush (file);
+			if (file->sync == 2 && file->fd != -1)
+				log_fsync (file->fd);
+		}
+		g_slist_free (touched);
+	}
+
+	return NULL;
+}
+
+static struct log_op *
+log_op_new (int type, struct log_file *file, char *path, gsize len)
+{
+	struct log_op *op = g_malloc (G_STRUCT_OFFSET (struct log_op, data) + len + 1);
+
+	op->type = type;
+	op->sync = prefs.hex_irc_log_sync;
+	op->file = file;
+	op->path = g_strdup (path);
+	op->len = len;
+
+	return op;
+}
+
+static struct log_op *
+log_op_new_text (int type, struct log_file *file, char *path, char *text)
+{
+	struct log_op *op = log_op_new (type, file, path, strlen (text));
+
+	memcpy (op->data, text, op->len + 1);
+	g_free (text);
+
+	return op;
+}
+
+static gboolean log_check_timeout (gpointer data);
+
+static void
+log_push (struct log_op *op)
+{
+	struct log_op *head;
+
+	if (!log_thread)
+	{
+		log_thread = g_thread_new ("log writer", log_writer, NULL);
+		log_check_tag = fe_timeout_add_seconds (LOG_CHECK_INTERVAL, log_check_timeout, NULL);
+	}
+
+	do
+	{
+		head = g_atomic_pointer_get (&log_queue);
+		op->next = head;
+	}
+	while (!g_atomic_pointer_compare_and_exchange (&log_queue, head, op));
+
+	/* the writer can only be asleep if it found the queue empty */
+	if (!head)
+	{
+		g_mutex_lock (&log_lock);
+		g_cond_signal (&log_wake);
+		g_mutex_unlock (&log_lock);
+	}
+}
+
+static char *
+log_line (const char *fmt)
+{
+	time_t currenttime = time (NULL);
+
+	return g_strdup_printf (fmt, ctime (&currenttime));
+}
+
+static void
+log_report_error (void)
+{
+	static gboolean log_error = FALSE;
+	char *path, *message;
+
+	path = g_atomic_pointer_get (&log_error_path);
+	if (!path || !g_atomic_pointer_compare_and_exchange (&log_error_path, path, NULL))
+		return;
+
+	if (!log_error)
+	{
+		message = g_strdup_printf (_("* Can't open log file(s) for writing. Check the\npermissions on %s"), path);
+		fe_message (message, FE_MSG_WAIT | FE_MSG_ERROR);
 		g_free (message);
 
 		log_error = TRUE;
 	}
+	g_free (path);
+}
+
+/* the log mask can put dates in the path, so every so often have the
+   writer move each log to wherever it should be now */
+static gboolean
+log_check_timeout (gpointer data)
+{
+	GSList *list;
+	session *sess;
+	char *path;
+
+	for (list = sess_list; list; list = list->next)
+	{
+		sess = list->data;
+		if (!sess->logfile)
+			continue;
+
+		path = log_create_pathname (sess->server->servername, sess->channel,
+											 server_get_network (sess->server, FALSE));
+		log_push (log_op_new_text (LOG_OP_CHECK, sess->logfile, path,
+											log_line (_("**** BEGIN LOGGING AT %s\n"))));
+		g_free (path);
+	}
+
+	log_report_error ();
+	return 1;
+}
+
+void
+log_close (session *sess)
+{
+	if (sess->logfile)
+	{
+		log_push (log_op_new_text (LOG_OP_CLOSE, sess->logfile, NULL,
+											log_line (_("**** ENDING LOGGING AT %s\n"))));
+		sess->logfile = NULL;
+	}
+}
+
+static void
+log_open (session *sess)
+{
+	char *path;
+
+	log_close (sess);
+
+	sess->logfile = g_new0 (struct log_file, 1);
+	sess->logfile->fd = -1;
+	sess->logfile->pending = g_string_new (NULL);
+
+	path = log_create_pathname (sess->server->servername, sess->channel,
+										 server_get_network (sess->server, FALSE));
+	log_push (log_op_new_text (LOG_OP_OPEN, sess->logfile, path,
+										log_line (_("**** BEGIN LOGGING AT %s\n"))));
+	g_free (path);
+}
+
+/* writes text to sess's log as it is */
+void
+log_append (session *sess, char *text)
+{
+	if (sess->logfile)
+		log_push (log_op_new_text (LOG_OP_WRITE, sess->logfile, NULL, g_strdup (text)));
+}
+
+/* waits for everything queued to reach the disk, call once all the
+   sessions are closed */
+void
+log_shutdown (void)
+{
+	if (!log_thread)
+		return;
+
+	fe_timeout_remove (log_check_tag);
+	log_push (log_op_new (LOG_OP_QUIT, NULL, NULL, 0));
+	g_thread_join (log_thread);
+	log_thread = NULL;
 }
 
 void
@@ -624,41 +1211,91 @@ log_open_or_close (session *sess)
 	}
 }
 
-int
-get_stamp_str (char *fmt, time_t tim, char **ret)
+/* The last few stamp formats used, each with its format already in
+   locale encoding and the stamp it gave for the last second asked for,
+   so a burst of lines pays for strftime() once a second. */
+
+#define STAMP_CACHE_SIZE 4
+
+struct stamp_cache
 {
-	char dest[128];
-	gsize len_locale;
-	gsize len_utf8;
+	char *fmt;					/* UTF-8, as callers pass it */
+	char *fmt_locale;			/* what strftime() wants, NULL if it won't convert */
+	time_t when;
+	int len;
+	char stamp[256];			/* UTF-8 */
+};
 
-	/* strftime requires the format string to be in locale encoding. */
-	fmt = g_locale_from_utf8 (fmt, -1, NULL, NULL, NULL);
+static struct stamp_cache stamp_cache[STAMP_CACHE_SIZE];
+static int stamp_cache_next;
 
-	len_locale = strftime_validated (dest, sizeof (dest), fmt, localtime (&tim));
+/* Returns fmt rendered for tim, and its length in *len (0 if it failed).
+   The string belongs to the cache and is only good until the next call,
+   so only use this from the main thread. */
+const char *
+get_stamp_cached (const char *fmt, time_t tim, int *len)
+{
+	struct stamp_cache *sc = NULL;
+	char dest[128];
+	char *utf8;
+	gsize len_locale, len_utf8;
+	int i;
 
-	g_free (fmt);
+	for (i = 0; i < STAMP_CACHE_SIZE; i++)
+	{
+		if (stamp_cache[i].fmt && strcmp (stamp_cache[i].fmt, fmt) == 0)
+		{
+			sc = &stamp_cache[i];
+			break;
+		}
+	}
 
-	if (len_locale == 0)
+	if (!sc)
 	{
-		return 0;
+		sc = &stamp_cache[stamp_cache_next];
+		stamp_cache_next = (stamp_cache_next + 1) % STAMP_CACHE_SIZE;
+
+		g_free (sc->fmt);
+		g_free (sc->fmt_locale);
+		sc->fmt = g_strdup (fmt);
+		/* strftime requires the format string to be in locale encoding. */
+		sc->fmt_locale = g_locale_from_utf8 (fmt, -1, NULL, NULL, NULL);
 	}
+	else if (sc->when == tim)
+	{
+		*len = sc->len;
+		return sc->stamp;
+	}
+
+	sc->when = tim;
+	sc->len = 0;
+	sc->stamp[0] = 0;
 
-	*ret = g_locale_to_utf8 (dest, len_locale, NULL, &len_utf8, NULL);
-	if (*ret == NULL)
+	if (sc->fmt_locale)
 	{
-		return 0;
+		len_locale = strftime_validated (dest, sizeof (dest), sc->fmt_locale, localtime (&tim));
+		if (len_locale)
+		{
+			utf8 = g_locale_to_utf8 (dest, len_locale, NULL, &len_utf8, NULL);
+			if (utf8 && len_utf8 < sizeof (sc->stamp))
+			{
+				memcpy (sc->stamp, utf8, len_utf8 + 1);
+				sc->len = len_utf8;
+			}
+			g_free (utf8);
+		}
 	}
 
-	return len_utf8;
+	*len = sc->len;
+	return sc->stamp;
 }
 
 static void
 log_write (session *sess, char *text, time_t ts)
 {
-	char *temp;
-	char *stamp;
-	char *file;
-	int len;
+	struct log_op *op;
+	const char *stamp = NULL;
+	int stamp_len = 0, len;
 
 	if (sess->text_logging == SET_DEFAULT)
 	{
@@ -671,51 +1308,28 @@ log_write (session *sess, char *text, time_t ts)
 			return;
 	}
 
-	if (sess->logfd == -1)
-	{
+	if (!sess->logfile)
 		log_open (sess);
-	}
-
-	/* change to a different log file? */
-	file = log_create_pathname (sess->server->servername, sess->channel, server_get_network (sess->server, FALSE));
-	if (file)
-	{
-		if (g_access (file, F_OK) != 0)
-		{
-			if (sess->logfd != -1)
-			{
-				close (sess->logfd);
-			}
-
-			sess->logfd = log_open_file (sess->server->servername, sess->channel, server_get_network (sess->server, FALSE));
-		}
-
-		g_free (file);
-	}
-
-	if (sess->logfd == -1)
-	{
-		return;
-	}
+	log_report_error ();
 
 	if (prefs.hex_stamp_log)
 	{
 		if (!ts) ts = time(0);
-		len = get_stamp_str (prefs.hex_stamp_log_format, ts, &stamp);
-		if (len)
-		{
-			write (sess->logfd, stamp, len);
-			g_free (stamp);
-		}
+		stamp = get_stamp_cached (prefs.hex_stamp_log_format, ts, &stamp_len);
 	}
 
-	temp = strip_color (text, -1, STRIP_ALL);
-	len = strlen (temp);
-	write (sess->logfd, temp, len);
+	/* stamp, text stripped in place and maybe a \n, in one record */
+	len = strlen (text);
+	op = log_op_new (LOG_OP_WRITE, sess->logfile, NULL, stamp_len + len + 1);
+	if (stamp_len)
+		memcpy (op->data, stamp, stamp_len);
+	len = strip_color2 (text, len, op->data + stamp_len, STRIP_ALL);
+	op->len = stamp_len + len;
 	/* lots of scripts/plugins print without a \n at the end */
-	if (temp[len - 1] != '\n')
-		write (sess->logfd, "\n", 1);	/* emulate what xtext would display */
-	g_free (temp);
+	if (!len || op->data[op->len - 1] != '\n')
+		op->data[op->len++] = '\n';	/* emulate what xtext would display */
+
+	log_push (op);
 }
 
 /**
@@ -809,6 +1423,51 @@ text_convert_invalid (const gchar* text, gssize len, GIConv converter, const gch
 	}
 }
 
+/**
+ * Checks whether the given text is valid UTF-8 without allocating. Runs of ASCII are skipped eight bytes at a time, the rest is left to
+ * g_utf8_validate(). As with g_utf8_validate(), a \0 byte within len makes the text invalid.
+ *
+ * If len is -1, strlen(text) is used to calculate the length. If the text is valid and len_out is not NULL, the length is stored there.
+ */
+gboolean
+text_validate_utf8 (const gchar* text, gssize len, gsize *len_out)
+{
+	const guint64 low = G_GUINT64_CONSTANT (0x0101010101010101);
+	const guint64 high = G_GUINT64_CONSTANT (0x8080808080808080);
+	guint64 word;
+	gssize i = 0;
+
+	if (len == -1)
+	{
+		len = strlen (text);
+	}
+
+	while (i + 8 <= len)
+	{
+		memcpy (&word, text + i, 8);
+
+		/* Stop at the first word with a non-ASCII or a \0 byte. */
+		if ((word | ((word - low) & ~word)) & high)
+		{
+			break;
+		}
+
+		i += 8;
+	}
+
+	if (i < len && !g_utf8_validate (text + i, len - i, NULL))
+	{
+		return FALSE;
+	}
+
+	if (len_out != NULL)
+	{
+		*len_out = len;
+	}
+
+	return TRUE;
+}
+
 /**
  * Replaces any invalid UTF-8 in the given text with the unicode replacement character.
  */
@@ -835,9 +1494,11 @@ G_GNUC_END_IGNORE_DEPRECATIONS
 #endif
 }
 
-void
-PrintTextTimeStamp (session *sess, char *text, time_t timestamp)
+static void
+print_text_len (session *sess, char *text, gssize len, time_t timestamp)
 {
+	char *conv = NULL;
+
 	if (!sess)
 	{
 		if (!sess_list)
@@ -845,20 +1506,26 @@ PrintTextTimeStamp (session *sess, char *text, time_t timestamp)
 		sess = (session *) sess_list->data;
 	}
 
-	/* make sure it's valid utf8 */
+	/* make sure it's valid utf8, only copy it if it isn't */
 	if (text[0] == '\0')
 	{
-		text = g_strdup ("\n");
+		text = "\n";
 	}
-	else
+	else if (!text_validate_utf8 (text, len, NULL))
 	{
-		text = text_fixup_invalid_utf8 (text, -1, NULL);
+		text = conv = text_fixup_invalid_utf8 (text, len, NULL);
 	}
 
 	log_write (sess, text, timestamp);
 	scrollback_save (sess, text, timestamp);
 	fe_print_text (sess, text, timestamp, FALSE);
-	g_free (text);
+	g_free (conv);
+}
+
+void
+PrintTextTimeStamp (session *sess, char *text, time_t timestamp)
+{
+	print_text_len (sess, text, -1, timestamp);
 }
 
 void
@@ -950,11 +1617,36 @@ PrintTextTimeStampf (session *sess, time_t timestamp, const char *format, ...)
    of the work)
 
    --AGL
+
+   pevent_make_pntevts() then turns each pntevts[] string into a list of
+   ops (pntevts_ops[]) whose literal runs point back into it, along with
+   the total length of those runs, so format_event() doesn't decode the
+   bytes again on every event.
  */
 
 char *pntevts_text[NUM_XP];
 char *pntevts[NUM_XP];
 
+#define PEVT_MAXARGS 4		/* $1-$4, what text_emit() can pass */
+
+enum
+{
+	PEVT_OP_END,
+	PEVT_OP_TEXT,
+	PEVT_OP_ARG,
+	PEVT_OP_TAB
+};
+
+struct pevt_op
+{
+	int type;				/* PEVT_OP_* */
+	int len;					/* TEXT: bytes at text, ARG: argument number */
+	const char *text;
+};
+
+static struct pevt_op *pntevts_ops[NUM_XP];
+static int pntevts_fixed_len[NUM_XP];	/* literal bytes in an event, with the \n */
+
 #define pevt_generic_none_help NULL
 
 static char * const pevt_genmsg_help[] = {
@@ -1543,6 +2235,73 @@ pevent_load_defaults (void)
 	}
 }
 
+/* returns the number of ops, filling ops[] and *fixed_len if given */
+static int
+pevent_decode (int index, struct pevt_op *ops, int *fixed_len)
+{
+	const char *i = pntevts[index];
+	int numargs = te[index].num_args & 0x7f;
+	int ii = 0, n = 0, fixed = 1, len, a;
+
+	for (;;)
+	{
+		switch (i[ii++])
+		{
+		case 0:
+			memcpy (&len, &i[ii], sizeof (int));
+			ii += sizeof (int);
+			if (ops)
+			{
+				ops[n].type = PEVT_OP_TEXT;
+				ops[n].len = len;
+				ops[n].text = &i[ii];
+			}
+			n++;
+			fixed += len;
+			ii += len;
+			break;
+		case 1:
+			a = i[ii++];
+			/* args past the ones the event has, or the ones
+			   text_emit() passes, always print as nothing */
+			if (a > numargs || a >= PEVT_MAXARGS)
+			{
+				if (a > numargs)
+					fprintf (stderr, "HexChat DEBUG: display_event: arg > numargs (%d %d %s)\n",
+								a, numargs, te[index].name);
+				break;
+			}
+			if (ops)
+			{
+				ops[n].type = PEVT_OP_ARG;
+				ops[n].len = a + 1;
+			}
+			n++;
+			break;
+		case 2:
+			if (ops)
+				ops[n].type = PEVT_OP_END;
+			if (fixed_len)
+				*fixed_len = fixed;
+			return n + 1;
+		case 3:
+			if (ops)
+				ops[n].type = PEVT_OP_TAB;
+			n++;
+			fixed++;
+			break;
+		}
+	}
+}
+
+static void
+pevent_compile (int index)
+{
+	g_free (pntevts_ops[index]);
+	pntevts_ops[index] = g_new (struct pevt_op, pevent_decode (index, NULL, NULL));
+	pevent_decode (index, pntevts_ops[index], &pntevts_fixed_len[index]);
+}
+
 void
 pevent_make_pntevts (void)
 {
@@ -1581,6 +2340,8 @@ pevent_make_pntevts (void)
 				}
 			}
 		}
+
+		pevent_compile (i);
 	}
 }
 
@@ -1736,88 +2497,74 @@ load_text_events ()
 */
 #define ARG_FLAG(argn) (1 << (argn))
 
+/* Renders event index into out, replacing what was there. args[1] to
+   args[PEVT_MAXARGS] are the event's arguments. */
 void
-format_event (session *sess, int index, char **args, char *o, gsize sizeofo, unsigned int stripcolor_args)
+format_event (session *sess, int index, char **args, GString *out, unsigned int stripcolor_args)
 {
-	int len, ii, numargs;
-	gsize oi;
-	char *i, *ar, d, a, done_all = FALSE;
-
-	i = pntevts[index];
-	numargs = te[index].num_args & 0x7f;
+	struct pevt_op *op = pntevts_ops[index];
+	gsize oi, len;
+	char *ar;
 
-	oi = ii = len = d = a = 0;
-	o[0] = 0;
-
-	if (i == NULL)
+	g_string_truncate (out, 0);
+	if (op == NULL)
 		return;
 
-	while (done_all == FALSE)
+	for (; op->type != PEVT_OP_END; op++)
 	{
-		d = i[ii++];
-		switch (d)
+		switch (op->type)
 		{
-		case 0:
-			memcpy (&len, &(i[ii]), sizeof (int));
-			ii += sizeof (int);
-			if (oi + len > sizeofo)
-			{
-				printf ("Overflow in display_event (%s)\n", i);
-				o[0] = 0;
-				return;
-			}
-			memcpy (&(o[oi]), &(i[ii]), len);
-			oi += len;
-			ii += len;
+		case PEVT_OP_TEXT:
+			g_string_append_len (out, op->text, op->len);
 			break;
-		case 1:
-			a = i[ii++];
-			if (a > numargs)
-			{
-				fprintf (stderr,
-							"HexChat DEBUG: display_event: arg > numargs (%d %d %s)\n",
-							a, numargs, i);
-				break;
-			}
-			ar = args[(int) a + 1];
+		case PEVT_OP_ARG:
+			ar = args[op->len];
 			if (ar == NULL)
 			{
-				printf ("arg[%d] is NULL in print event\n", a + 1);
-			} else
-			{
-				if (strlen (ar) > sizeofo - oi - 4)
-					ar[sizeofo - oi - 4] = 0;	/* Avoid buffer overflow */
-				if (stripcolor_args & ARG_FLAG(a + 1)) len = strip_color2 (ar, -1, &o[oi], STRIP_ALL);
-				else len = strip_hidden_attribute (ar, &o[oi]);
-				oi += len;
+				printf ("arg[%d] is NULL in print event\n", op->len);
+				break;
 			}
+			/* strip straight into the end of out */
+			oi = out->len;
+			len = strlen (ar);
+			g_string_set_size (out, oi + len);
+			len = strip_color2 (ar, len, out->str + oi,
+									  (stripcolor_args & ARG_FLAG (op->len)) ? STRIP_ALL : STRIP_HIDDEN);
+			g_string_truncate (out, oi + len);
 			break;
-		case 2:
-			o[oi++] = '\n';
-			o[oi++] = 0;
-			done_all = TRUE;
-			continue;
-		case 3:
-			if (prefs.hex_text_indent)
-				o[oi++] = '\t';
-			else
-				o[oi++] = ' ';
+		case PEVT_OP_TAB:
+			g_string_append_c (out, prefs.hex_text_indent ? '\t' : ' ');
 			break;
 		}
 	}
-	o[oi] = 0;
-	if (*o == '\n')
-		o[0] = 0;
+
+	g_string_append_c (out, '\n');
+	if (out->str[0] == '\n')
+		g_string_truncate (out, 0);
 }
 
 static void
 display_event (session *sess, int event, char **args, 
 					unsigned int stripcolor_args, time_t timestamp)
 {
-	char o[4096];
-	format_event (sess, event, args, o, sizeof (o), stripcolor_args);
-	if (o[0])
-		PrintTextTimeStamp (sess, o, timestamp);
+	static GString *buf = NULL;
+	static int depth = 0;
+	GString *out;
+
+	/* the shared buffer is in use if printing this led to another event */
+	if (!buf)
+		buf = g_string_sized_new (512);
+	if (depth++)
+		out = g_string_sized_new (pntevts_fixed_len[event] + 256);
+	else
+		out = buf;
+
+	format_event (sess, event, args, out, stripcolor_args);
+	if (out->len)
+		print_text_len (sess, out->str, out->len, timestamp);
+
+	if (--depth)
+		g_string_free (out, TRUE);
 }
 
 int
@@ -2036,8 +2783,7 @@ void
 text_emit (int index, session *sess, char *a, char *b, char *c, char *d,
 			  time_t timestamp)
 {
-	char *word[PDIWORDS];
-	int i;
+	char *word[PEVT_MAXARGS + 1];
 	unsigned int stripcolor_args = (chanopt_is_set (prefs.hex_text_stripcolor_msg, sess->text_strip) ? 0xFFFFFFFF : 0);
 	char tbuf[NICKLEN + 4];
 
@@ -2053,8 +2799,6 @@ text_emit (int index, session *sess, char *a, char *b, char *c, char *d,
 	word[2] = (b ? b : "\000");
 	word[3] = (c ? c : "\000");
 	word[4] = (d ? d : "\000");
-	for (i = 5; i < PDIWORDS; i++)
-		word[i] = "\000";
 
 	switch (index)
 	{
@@ -39,6 +39,7 @@ struct text_event
 
 void scrollback_close (session *sess);
 void scrollback_load (session *sess);
+int scrollback_load_older (session *sess, int lines);
 
 int text_word_check (char *word, int len);
 void PrintText (session *sess, char *text);
@@ -46,6 +47,8 @@ void PrintTextTimeStamp (session *sess, char *text, time_t timestamp);
 void PrintTextf (session *sess, const char *format, ...) G_GNUC_PRINTF (2, 3);
 void PrintTextTimeStampf (session *sess, time_t timestamp, const char *format, ...) G_GNUC_PRINTF (3, 4);
 void log_close (session *sess);
+void log_append (session *sess, char *text);
+void log_shutdown (void);
 void log_open_or_close (session *sess);
 void load_text_events (void);
 void pevent_save (char *fn);
@@ -58,9 +61,10 @@ void text_emit (int index, session *sess, char *a, char *b, char *c, char *d,
 int text_emit_by_name (char *name, session *sess, time_t timestamp,
 					   char *a, char *b, char *c, char *d);
 gchar *text_convert_invalid (const gchar* text, gssize len, GIConv converter, const gchar *fallback, gsize *len_out);
+gboolean text_validate_utf8 (const gchar* text, gssize len, gsize *len_out);
 gchar *text_fixup_invalid_utf8 (const gchar* text, gssize len, gsize *len_out);
-int get_stamp_str (char *fmt, time_t tim, char **ret);
-void format_event (session *sess, int index, char **args, char *o, gsize sizeofo, unsigned int stripcolor_args);
+const char *get_stamp_cached (const char *fmt, time_t tim, int *len);
+void format_event (session *sess, int index, char **args, GString *out, unsigned int stripcolor_args);
 char *text_find_format_string (char *name);
 
 extern const gchar* unicode_fallback_string;
@@ -28,7 +28,7 @@ a tree, but it could be :)
 
 #include "tree.h"
 
-#define ARRAY_GROW 32
+#define ARRAY_GROW 32	/* initial size, doubled from there */
 
 struct _tree
 {
@@ -216,7 +216,7 @@ tree_grow (tree *t)
 {
 	if (t->array_size < t->elements + 1)
 	{
-		int new_size = t->array_size + ARRAY_GROW;
+		int new_size = t->array_size ? t->array_size * 2 : ARRAY_GROW;
 
 		t->array = realloc (t->array, sizeof (void *) * new_size);
 		t->array_size = new_size;
@@ -247,6 +247,22 @@ tree_append (tree *t, void *key)
 	tree_insert_at_pos (t, key, t->elements);
 }
 
+static int
+tree_sort_cmp (gconstpointer a, gconstpointer b, gpointer data)
+{
+	tree *t = data;
+
+	return t->cmp (*(void **)a, *(void **)b, t->data);
+}
+
+/* put keys added with tree_append in order */
+void
+tree_sort (tree *t)
+{
+	if (t->elements > 1)
+		g_qsort_with_data (t->array, t->elements, sizeof (void *), tree_sort_cmp, t);
+}
+
 int tree_size (tree *t)
 {
 	return t->elements;
@@ -49,42 +49,128 @@ nick_cmp_az_ops (server *serv, struct User *user1, struct User *user2)
 		}
 	}
 
-	return serv->p_cmp (user1->nick, user2->nick);
+	return serv->p_cmp (user1->person->nick, user2->person->nick);
 }
 
 int
 nick_cmp_alpha (struct User *user1, struct User *user2, server *serv)
 {
-	return serv->p_cmp (user1->nick, user2->nick);
+	return serv->p_cmp (user1->person->nick, user2->person->nick);
 }
 
-/*
- insert name in appropriate place in linked list. Returns row number or:
-  -1: duplicate
-*/
+/* Everyone we share a channel with has one struct person per server,
+   found by nick in serv->people. Each channel they're in holds a struct
+   User for their prefix and access bits, and the person's sessions list
+   is both the channels they're in and the record's refcount. */
 
-static int
-userlist_insertname (session *sess, struct User *newuser)
+static struct person *
+person_find (server *serv, const char *nick)
+{
+	char key[NICKLEN];
+
+	if (!casefold_key (serv->casemapping, key, nick, sizeof (key)))
+		return NULL;
+	return g_hash_table_lookup (serv->people, key);
+}
+
+static void
+person_set_nick (server *serv, struct person *person, const char *nick)
+{
+	safe_strcpy (person->nick, nick, NICKLEN);
+	casefold_key (serv->casemapping, person->key, person->nick, NICKLEN);
+	/* the key is the folded nick inside the record itself */
+	g_hash_table_replace (serv->people, person->key, person);
+}
+
+static struct person *
+person_get (server *serv, const char *nick)
+{
+	struct person *person = person_find (serv, nick);
+
+	if (!person)
+	{
+		person = g_new0 (struct person, 1);
+		person_set_nick (serv, person, nick);
+	}
+
+	return person;
+}
+
+static void
+person_release (session *sess, struct person *person)
+{
+	person->sessions = g_slist_remove (person->sessions, sess);
+	if (person->sessions)
+		return;
+
+	if (g_hash_table_lookup (sess->server->people, person->key) == person)
+		g_hash_table_remove (sess->server->people, person->key);
+	g_free (person->hostname);
+	g_free (person->realname);
+	g_free (person->servername);
+	g_free (person->account);
+	g_free (person);
+}
+
+GSList *
+userlist_sessions (server *serv, const char *nick)
+{
+	struct person *person = person_find (serv, nick);
+
+	return person ? person->sessions : NULL;
+}
+
+/* sess->userhash is what lookups use. The alphabetical sess->usertree is
+   only a view of it, thrown away on every add/remove/rename and rebuilt
+   when something wants to walk the list in order. */
+
+static void
+userlist_view_invalidate (session *sess)
+{
+	tree_destroy (sess->usertree);
+	sess->usertree = NULL;
+}
+
+static void
+view_append_cb (gpointer key, struct User *user, tree *view)
+{
+	tree_append (view, user);
+}
+
+static tree *
+userlist_view (session *sess)
 {
-	if (!sess->usertree)
+	if (!sess->usertree && sess->userhash)
 	{
 		sess->usertree = tree_new ((tree_cmp_func *)nick_cmp_alpha, sess->server);
+		g_hash_table_foreach (sess->userhash, (GHFunc)view_append_cb, sess->usertree);
+		tree_sort (sess->usertree);
 	}
 
-	return tree_insert (sess->usertree, newuser);
+	return sess->usertree;
 }
 
 void
-userlist_set_away (struct session *sess, char *nick, unsigned int away)
+userlist_foreach (session *sess, tree_traverse_func *func, void *data)
 {
+	tree_foreach (userlist_view (sess), func, data);
+}
+
+void
+userlist_set_away (server *serv, char *nick, unsigned int away)
+{
+	struct person *person = person_find (serv, nick);
+	GSList *list;
+	session *sess;
 	struct User *user;
 
-	user = userlist_find (sess, nick);
-	if (user)
+	if (person && person->away != away)
 	{
-		if (user->away != away)
+		person->away = away;
+		for (list = person->sessions; list; list = list->next)
 		{
-			user->away = away;
+			sess = list->data;
+			user = g_hash_table_lookup (sess->userhash, person);
 			/* rehash GUI */
 			fe_userlist_rehash (sess, user);
 			if (away)
@@ -94,20 +180,19 @@ userlist_set_away (struct session *sess, char *nick, unsigned int away)
 }
 
 void
-userlist_set_account (struct session *sess, char *nick, char *account)
+userlist_set_account (server *serv, char *nick, char *account)
 {
-	struct User *user;
+	struct person *person = person_find (serv, nick);
 
-	user = userlist_find (sess, nick);
-	if (user)
+	if (person)
 	{
 		if (strcmp (account, "*") == 0)
 		{
-			g_clear_pointer (&user->account, g_free);
-		} else if (g_strcmp0 (user->account, account))
+			g_clear_pointer (&person->account, g_free);
+		} else if (g_strcmp0 (person->account, account))
 		{
-			g_free (user->account);
-			user->account = g_strdup (account);
+			g_free (person->account);
+			person->account = g_strdup (account);
 		}
 
 		/* gui doesnt currently reflect login status, maybe later
@@ -120,62 +205,72 @@ userlist_add_hostname (struct session *sess, char *nick, char *hostname,
 							  char *realname, char *servername, char *account, unsigned int away)
 {
 	struct User *user;
+	struct person *person;
 	gboolean do_rehash = FALSE;
+	GSList *list;
 
 	user = userlist_find (sess, nick);
 	if (user)
 	{
-		if (hostname && (!user->hostname || strcmp(user->hostname, hostname)))
+		person = user->person;
+		if (hostname && (!person->hostname || strcmp(person->hostname, hostname)))
 		{
 			if (prefs.hex_gui_ulist_show_hosts)
 				do_rehash = TRUE;
-			g_free (user->hostname);
-			user->hostname = g_strdup (hostname);
+			g_free (person->hostname);
+			person->hostname = g_strdup (hostname);
 		}
-		if (realname && *realname && g_strcmp0 (user->realname, realname) != 0)
+		if (realname && *realname && g_strcmp0 (person->realname, realname) != 0)
 		{
-			g_free (user->realname);
-			user->realname = g_strdup (realname);
+			g_free (person->realname);
+			person->realname = g_strdup (realname);
 		}
-		if (!user->servername && servername)
-			user->servername = g_strdup (servername);
-		if (!user->account && account && strcmp (account, "0") != 0)
-			user->account = g_strdup (account);
+		if (!person->servername && servername)
+			person->servername = g_strdup (servername);
+		if (!person->account && account && strcmp (account, "0") != 0)
+			person->account = g_strdup (account);
 		if (away != 0xff)
 		{
-			if (user->away != away)
+			if (person->away != away)
 				do_rehash = TRUE;
-			user->away = away;
+			person->away = away;
 		}
 
-		fe_userlist_update (sess, user);
-		if (do_rehash)
-			fe_userlist_rehash (sess, user);
+		/* every channel they're in shows the same record */
+		for (list = person->sessions; list; list = list->next)
+		{
+			sess = list->data;
+			user = g_hash_table_lookup (sess->userhash, person);
+			fe_userlist_update (sess, user);
+			if (do_rehash)
+				fe_userlist_rehash (sess, user);
+		}
 
 		return 1;
 	}
 	return 0;
 }
 
-static int
-free_user (struct User *user, gpointer data)
+static void
+free_user_cb (struct person *person, struct User *user, session *sess)
 {
-	g_free (user->realname);
-	g_free (user->hostname);
-	g_free (user->servername);
-	g_free (user->account);
+	person_release (sess, person);
 	g_free (user);
-
-	return TRUE;
 }
 
 void
 userlist_free (session *sess)
 {
-	tree_foreach (sess->usertree, (tree_traverse_func *)free_user, NULL);
-	tree_destroy (sess->usertree);
+	if (sess->userhash)
+	{
+		g_hash_table_foreach (sess->userhash, (GHFunc)free_user_cb, sess);
+		g_hash_table_destroy (sess->userhash);
+		sess->userhash = NULL;
+	}
+	userlist_view_invalidate (sess);
+
+	sess->names_pending = FALSE;
 
-	sess->usertree = NULL;
 	sess->me = NULL;
 
 	sess->ops = 0;
@@ -192,20 +287,13 @@ userlist_clear (session *sess)
 	fe_userlist_numbers (sess);
 }
 
-static int
-find_cmp (const char *name, struct User *user, server *serv)
-{
-	return serv->p_cmp ((char *)name, user->nick);
-}
-
 struct User *
 userlist_find (struct session *sess, const char *name)
 {
-	int pos;
+	struct person *person;
 
-	if (sess->usertree)
-		return tree_find (sess->usertree, name,
-								(tree_cmp_func *)find_cmp, sess->server, &pos);
+	if (sess->userhash && (person = person_find (sess->server, name)))
+		return g_hash_table_lookup (sess->userhash, person);
 
 	return NULL;
 }
@@ -213,20 +301,10 @@ userlist_find (struct session *sess, const char *name)
 struct User *
 userlist_find_global (struct server *serv, char *name)
 {
-	struct User *user;
-	session *sess;
-	GSList *list = sess_list;
-	while (list)
-	{
-		sess = (session *) list->data;
-		if (sess->server == serv)
-		{
-			user = userlist_find (sess, name);
-			if (user)
-				return user;
-		}
-		list = list->next;
-	}
+	struct person *person = person_find (serv, name);
+
+	if (person)
+		return g_hash_table_lookup (((session *)person->sessions->data)->userhash, person);
 	return NULL;
 }
 
@@ -257,7 +335,6 @@ userlist_update_mode (session *sess, char *name, char mode, char sign)
 	int access;
 	int offset = 0;
 	int level;
-	int pos;
 	char prefix;
 	struct User *user;
 
@@ -265,8 +342,7 @@ userlist_update_mode (session *sess, char *name, char mode, char sign)
 	if (!user)
 		return;
 
-	/* remove from binary trees, before we loose track of it */
-	tree_remove (sess->usertree, user, &pos);
+	/* the frontend sorts by rank, so it has to move */
 	fe_userlist_remove (sess, user);
 
 	/* which bit number is affected? */
@@ -297,31 +373,70 @@ userlist_update_mode (session *sess, char *name, char mode, char sign)
 	update_counts (sess, user, prefix, level, offset);
 
 	/* insert it back into its new place */
-	tree_insert (sess->usertree, user);
 	fe_userlist_insert (sess, user, FALSE);
 	fe_userlist_numbers (sess);
 }
 
+/* renames the person in every channel at once */
 int
-userlist_change (struct session *sess, char *oldname, char *newname)
+userlist_change (server *serv, char *oldname, char *newname)
 {
-	struct User *user = userlist_find (sess, oldname);
-	int pos;
+	struct person *person = person_find (serv, oldname);
+	GSList *list;
+	session *sess;
 
-	if (user)
+	if (!person)
+		return 0;
+
+	for (list = person->sessions; list; list = list->next)
 	{
-		tree_remove (sess->usertree, user, &pos);
-		fe_userlist_remove (sess, user);
+		sess = list->data;
+		fe_userlist_remove (sess, g_hash_table_lookup (sess->userhash, person));
+	}
+
+	if (g_hash_table_lookup (serv->people, person->key) == person)
+		g_hash_table_steal (serv->people, person->key);
+	person_set_nick (serv, person, newname);
 
-		safe_strcpy (user->nick, newname, NICKLEN);
+	for (list = person->sessions; list; list = list->next)
+	{
+		sess = list->data;
+		userlist_view_invalidate (sess);
+		fe_userlist_insert (sess, g_hash_table_lookup (sess->userhash, person), FALSE);
+	}
 
-		tree_insert (sess->usertree, user);
-		fe_userlist_insert (sess, user, FALSE);
+	return 1;
+}
 
-		return 1;
+static void
+rekey_cb (gpointer key, struct person *person, GSList **list)
+{
+	*list = g_slist_prepend (*list, person);
+}
+
+/* serv->casemapping changed: refold everyone's key and resort */
+void
+userlist_rekey (server *serv)
+{
+	GSList *people = NULL, *list;
+	struct person *person;
+	session *sess;
+
+	g_hash_table_foreach (serv->people, (GHFunc)rekey_cb, &people);
+	g_hash_table_steal_all (serv->people);
+	for (list = people; list; list = list->next)
+	{
+		person = list->data;
+		person_set_nick (serv, person, person->nick);
 	}
+	g_slist_free (people);
 
-	return 0;
+	for (list = sess_list; list; list = list->next)
+	{
+		sess = list->data;
+		if (sess->server == serv)
+			userlist_view_invalidate (sess);
+	}
 }
 
 int
@@ -340,7 +455,6 @@ userlist_remove (struct session *sess, char *name)
 void
 userlist_remove_user (struct session *sess, struct User *user)
 {
-	int pos;
 	if (user->voice)
 		sess->voices--;
 	if (user->op)
@@ -354,57 +468,69 @@ userlist_remove_user (struct session *sess, struct User *user)
 	if (user == sess->me)
 		sess->me = NULL;
 
-	tree_remove (sess->usertree, user, &pos);
-	free_user (user, NULL);
+	g_hash_table_remove (sess->userhash, user->person);
+	userlist_view_invalidate (sess);
+	person_release (sess, user->person);
+	g_free (user);
 }
 
-void
-userlist_add (struct session *sess, char *name, char *hostname,
-				  char *account, char *realname, const message_tags_data *tags_data)
+/* adds name (with its prefix chars) to the channel without telling the
+   frontend or notify. Returns NULL for a duplicate. */
+static struct User *
+userlist_insert (struct session *sess, char *name, char *hostname,
+					  char *account, char *realname)
 {
 	struct User *user;
-	int row, prefix_chars;
+	struct person *person;
+	int prefix_chars;
 	unsigned int acc;
 
 	acc = nick_access (sess->server, name, &prefix_chars);
 
-	notify_set_online (sess->server, name + prefix_chars, tags_data);
+	if (!sess->userhash)
+		sess->userhash = g_hash_table_new (g_direct_hash, g_direct_equal);
 
-	user = g_new0 (struct User, 1);
+	person = person_get (sess->server, name + prefix_chars);
+
+	/* duplicate? some broken servers trigger this */
+	if (g_hash_table_lookup (sess->userhash, person))
+		return NULL;
+
+	if (hostname && g_strcmp0 (person->hostname, hostname))
+	{
+		g_free (person->hostname);
+		person->hostname = g_strdup (hostname);
+	}
+	/* extended join info */
+	if (sess->server->have_extjoin)
+	{
+		if (account && *account && g_strcmp0 (person->account, account))
+		{
+			g_free (person->account);
+			person->account = g_strdup (account);
+		}
+		if (realname && *realname && g_strcmp0 (person->realname, realname))
+		{
+			g_free (person->realname);
+			person->realname = g_strdup (realname);
+		}
+	}
 
+	user = g_new0 (struct User, 1);
+	user->person = person;
 	user->access = acc;
 
 	/* assume first char is the highest level nick prefix */
 	if (prefix_chars)
 		user->prefix[0] = name[0];
 
-	/* add it to our linked list */
-	if (hostname)
-		user->hostname = g_strdup (hostname);
-	safe_strcpy (user->nick, name + prefix_chars, NICKLEN);
 	/* is it me? */
-	if (!sess->server->p_cmp (user->nick, sess->server->nick))
+	if (!sess->server->p_cmp (person->nick, sess->server->nick))
 		user->me = TRUE;
-	/* extended join info */
-	if (sess->server->have_extjoin)
-	{
-		if (account && *account)
-			user->account = g_strdup (account);
-		if (realname && *realname)
-			user->realname = g_strdup (realname);
-	}
 
-	row = userlist_insertname (sess, user);
-
-	/* duplicate? some broken servers trigger this */
-	if (row == -1)
-	{
-		g_free (user->hostname);
-		g_free (user->account);
-		g_free (user->realname);
-		g_free (user);
-		return;
-	}
+	person->sessions = g_slist_prepend (person->sessions, sess);
+	g_hash_table_insert (sess->userhash, person, user);
+	userlist_view_invalidate (sess);
 
 	sess->total++;
 
@@ -420,11 +546,44 @@ userlist_add (struct session *sess, char *name, char *hostname,
 	if (user->me)
 		sess->me = user;
 
+	return user;
+}
+
+void
+userlist_add (struct session *sess, char *name, char *hostname,
+				  char *account, char *realname, const message_tags_data *tags_data)
+{
+	struct User *user;
+	int prefix_chars;
+
+	nick_access (sess->server, name, &prefix_chars);
+	notify_set_online (sess->server, name + prefix_chars, tags_data);
+
+	user = userlist_insert (sess, name, hostname, account, realname);
+	if (!user)
+		return;
+
 	fe_userlist_insert (sess, user, FALSE);
 	if(sess->end_of_names)
 		fe_userlist_numbers (sess);
 }
 
+/* for NAMES: add users in bulk and call userlist_add_done after the
+   last one, so the frontend and notify hear about them only once */
+void
+userlist_add_quiet (struct session *sess, char *name, char *hostname)
+{
+	userlist_insert (sess, name, hostname, NULL, NULL);
+}
+
+void
+userlist_add_done (struct session *sess, const message_tags_data *tags_data)
+{
+	notify_set_online_channel (sess, tags_data);
+	fe_userlist_reload (sess);
+	fe_userlist_numbers (sess);
+}
+
 static int
 rehash_cb (struct User *user, session *sess)
 {
@@ -435,7 +594,7 @@ rehash_cb (struct User *user, session *sess)
 void
 userlist_rehash (session *sess)
 {
-	tree_foreach (sess->usertree, (tree_traverse_func *)rehash_cb, sess);
+	userlist_foreach (sess, (tree_traverse_func *)rehash_cb, sess);
 }
 
 static int
@@ -450,7 +609,7 @@ userlist_flat_list (session *sess)
 {
 	GSList *list = NULL;
 
-	tree_foreach (sess->usertree, (tree_traverse_func *)flat_cb, &list);
+	userlist_foreach (sess, (tree_traverse_func *)flat_cb, &list);
 	return g_slist_reverse (list);
 }
 
@@ -466,6 +625,6 @@ userlist_double_list(session *sess)
 {
 	GList *list = NULL;
 
-	tree_foreach (sess->usertree, (tree_traverse_func *)double_cb, &list);
+	userlist_foreach (sess, (tree_traverse_func *)double_cb, &list);
 	return list;
 }
@@ -23,13 +23,23 @@
 #ifndef HEXCHAT_USERLIST_H
 #define HEXCHAT_USERLIST_H
 
-struct User
+/* who someone is, shared by every channel we see them in */
+struct person
 {
 	char nick[NICKLEN];
+	char key[NICKLEN];	/* nick folded by the server's CASEMAPPING */
 	char *hostname;
 	char *realname;
 	char *servername;
 	char *account;
+	GSList *sessions;		/* channels they're in, freed when it's empty */
+	unsigned int away:1;
+};
+
+/* their membership of one channel */
+struct User
+{
+	struct person *person;
 	time_t lasttalk;
 	unsigned int access;	/* axs bit field */
 	char prefix[2]; /* @ + % */
@@ -37,7 +47,6 @@ struct User
 	unsigned int hop:1;
 	unsigned int voice:1;
 	unsigned int me:1;
-	unsigned int away:1;
 	unsigned int selected:1;
 };
 
@@ -46,20 +55,25 @@ struct User
 int userlist_add_hostname (session *sess, char *nick,
 									char *hostname, char *realname,
 									char *servername, char *account, unsigned int away);
-void userlist_set_away (session *sess, char *nick, unsigned int away);
-void userlist_set_account (session *sess, char *nick, char *account);
+void userlist_set_away (server *serv, char *nick, unsigned int away);
+void userlist_set_account (server *serv, char *nick, char *account);
 struct User *userlist_find (session *sess, const char *name);
 struct User *userlist_find_global (server *serv, char *name);
+GSList *userlist_sessions (server *serv, const char *nick);
 void userlist_clear (session *sess);
 void userlist_free (session *sess);
 void userlist_add (session *sess, char *name, char *hostname, char *account,
 						 char *realname, const message_tags_data *tags_data);
+void userlist_add_quiet (session *sess, char *name, char *hostname);
+void userlist_add_done (session *sess, const message_tags_data *tags_data);
 int userlist_remove (session *sess, char *name);
 void userlist_remove_user (session *sess, struct User *user);
-int userlist_change (session *sess, char *oldname, char *newname);
+int userlist_change (server *serv, char *oldname, char *newname);
+void userlist_rekey (server *serv);
 void userlist_update_mode (session *sess, char *name, char mode, char sign);
 GSList *userlist_flat_list (session *sess);
 GList *userlist_double_list (session *sess);
+void userlist_foreach (session *sess, tree_traverse_func *func, void *data);
 void userlist_rehash (session *sess);
 int nick_cmp_az_ops (server *serv, struct User *user1, struct User *user2);
 int nick_cmp_alpha (struct User *user1, struct User *user2, server *serv);
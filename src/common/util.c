@@ -1019,21 +1019,102 @@ make_ping_time (void)
 	return (timev.tv_sec - 50000) * 1000 + timev.tv_usec/1000;
 }
 
+/* The three CASEMAPPINGs all fold one contiguous range of ASCII up by
+   0x20: A-Z for ascii, A-Z[\] for strict-rfc1459 and A-Z[\]^ for
+   rfc1459. The helpers take the top of that range as a constant so
+   each caller below gets its own specialized copy. */
+
+static inline int
+casemap_fold (unsigned char c, unsigned char hi)
+{
+	return (c >= 'A' && c <= hi) ? c + ('a' - 'A') : c;
+}
+
+/* fold eight bytes at once; bytes >= 0x80 are left alone */
+static inline guint64
+casemap_fold_word (guint64 w, unsigned char hi)
+{
+	const guint64 ones = G_GUINT64_CONSTANT (0x0101010101010101);
+	const guint64 high = ones * 0x80;
+	guint64 low = w & ~high;
+	guint64 ge_a = low + ones * (0x80 - 'A');
+	guint64 gt_hi = low + ones * (0x7f - hi);
+
+	return w | ((ge_a & ~gt_hi & ~w & high) >> 2);
+}
+
+static inline int
+casemap_casecmp (const char *s1, const char *s2, unsigned char hi)
+{
+	const unsigned char *p1 = (const unsigned char *)s1;
+	const unsigned char *p2 = (const unsigned char *)s2;
+	int c1, c2;
+
+	do
+	{
+		c1 = casemap_fold (*p1++, hi);
+		c2 = casemap_fold (*p2++, hi);
+	}
+	while (c1 == c2 && c1);
+
+	return c1 - c2;
+}
+
+static inline gboolean
+casemap_casefold (char *dst, const char *src, int size, unsigned char hi)
+{
+	size_t len = strlen (src);
+	size_t i = 0;
+	guint64 w;
+
+	if (len >= (size_t)size)
+		return FALSE;
+
+	for (; i + 8 <= len; i += 8)
+	{
+		memcpy (&w, src + i, 8);
+		w = casemap_fold_word (w, hi);
+		memcpy (dst + i, &w, 8);
+	}
+	for (; i < len; i++)
+		dst[i] = casemap_fold (src[i], hi);
+	dst[len] = 0;
+
+	return TRUE;
+}
+
 int
 rfc_casecmp (const char *s1, const char *s2)
 {
-	int c1, c2;
+	return casemap_casecmp (s1, s2, '^');
+}
+
+int
+strict_rfc_casecmp (const char *s1, const char *s2)
+{
+	return casemap_casecmp (s1, s2, ']');
+}
+
+int
+ascii_casecmp (const char *s1, const char *s2)
+{
+	return casemap_casecmp (s1, s2, 'Z');
+}
 
-	while (*s1 && *s2)
+/* Writes the key two names share when they're equal under the given
+   CASEMAPPING into dst. Returns FALSE if src doesn't fit in size. */
+gboolean
+casefold_key (int casemapping, char *dst, const char *src, int size)
+{
+	switch (casemapping)
 	{
-		c1 = (int)rfc_tolower (*s1);
-		c2 = (int)rfc_tolower (*s2);
-		if (c1 != c2)
-			return (c1 - c2);
-		s1++;
-		s2++;
+	case CASEMAP_ASCII:
+		return casemap_casefold (dst, src, size, 'Z');
+	case CASEMAP_STRICT_RFC1459:
+		return casemap_casefold (dst, src, size, ']');
+	default:
+		return casemap_casefold (dst, src, size, '^');
 	}
-	return (((int)*s1) - ((int)*s2));
 }
 
 int
@@ -1555,3 +1636,109 @@ strftime_utf8 (char *dest, gsize destsize, const char *format, time_t time)
 	g_date_free (date);
 	return result;
 }
+
+/* A bump allocator for scratch memory that only has to live until the next
+   arena_reset(). Requests that don't fit go to separate blocks, and the main
+   block is grown on reset so the next round fits without calling malloc.
+   It grows to at most ARENA_GROW_MAX times its first size, and goes back
+   to that size after ARENA_QUIET_RESETS rounds that didn't need more. */
+
+#define ARENA_GROW_MAX 4
+#define ARENA_QUIET_RESETS 64
+
+struct arena
+{
+	char *buf;
+	gsize size;
+	gsize initial;		/* size given to arena_new */
+	gsize used;
+	int quiet;			/* resets in a row that fit in the initial size */
+	GSList *spill;		/* blocks that didn't fit in buf */
+	gsize spilled;		/* total size of those blocks */
+};
+
+arena *
+arena_new (gsize size)
+{
+	arena *a = g_new0 (arena, 1);
+
+	a->buf = g_malloc (size);
+	a->size = a->initial = size;
+
+	return a;
+}
+
+gpointer
+arena_alloc (arena *a, gsize size)
+{
+	gpointer mem;
+
+	/* keep everything pointer aligned */
+	size = (size + sizeof (gpointer) - 1) & ~(sizeof (gpointer) - 1);
+
+	if (a->size - a->used < size)
+	{
+		mem = g_malloc (size);
+		a->spill = g_slist_prepend (a->spill, mem);
+		a->spilled += size;
+		return mem;
+	}
+
+	mem = a->buf + a->used;
+	a->used += size;
+
+	return mem;
+}
+
+char *
+arena_strndup (arena *a, const char *str, gsize len)
+{
+	char *dup = arena_alloc (a, len + 1);
+
+	memcpy (dup, str, len);
+	dup[len] = 0;
+
+	return dup;
+}
+
+void
+arena_reset (arena *a)
+{
+	gsize size = a->size;
+
+	if (a->spill)
+	{
+		g_slist_free_full (a->spill, g_free);
+		a->spill = NULL;
+		size = MIN (a->size + a->spilled, a->initial * ARENA_GROW_MAX);
+		a->spilled = 0;
+		a->quiet = 0;
+	}
+	else if (a->size > a->initial)
+	{
+		if (a->used > a->initial)
+			a->quiet = 0;
+		else if (++a->quiet >= ARENA_QUIET_RESETS)
+		{
+			size = a->initial;
+			a->quiet = 0;
+		}
+	}
+
+	if (size != a->size)
+	{
+		g_free (a->buf);
+		a->buf = g_malloc (size);
+		a->size = size;
+	}
+
+	a->used = 0;
+}
+
+void
+arena_free (arena *a)
+{
+	g_slist_free_full (a->spill, g_free);
+	g_free (a->buf);
+	g_free (a);
+}
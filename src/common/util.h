@@ -35,6 +35,11 @@
 
 #define rfc_tolower(c) (rfc_tolowertab[(unsigned char)(c)])
 
+/* 005 CASEMAPPING values */
+#define CASEMAP_RFC1459 0
+#define CASEMAP_STRICT_RFC1459 1
+#define CASEMAP_ASCII 2
+
 #define ELLIPSIS "\xe2\x80\xa6"
 
 extern const unsigned char rfc_tolowertab[];
@@ -46,6 +51,9 @@ char *file_part (char *file);
 void for_files (const char *dirname, const char *mask, void callback (char *file));
 int rfc_casecmp (const char *, const char *);
 int rfc_ncasecmp (char *, char *, int);
+int strict_rfc_casecmp (const char *, const char *);
+int ascii_casecmp (const char *, const char *);
+gboolean casefold_key (int casemapping, char *dst, const char *src, int size);
 int buf_get_line (char *, char **, int *, int len);
 char *nocasestrstr (const char *text, const char *tofind);
 char *country (char *);
@@ -80,4 +88,15 @@ char *encode_sasl_pass_plain (char *user, char *pass);
 char *challengeauth_response (const char *username, const char *password, const char *challenge);
 size_t strftime_validated (char *dest, size_t destsize, const char *format, const struct tm *time);
 gsize strftime_utf8 (char *dest, gsize destsize, const char *format, time_t time);
+
+/* Scratch memory that lives until the next arena_reset. serv->scratch is
+   reset after each read batch in server_read_drain, so anything else that
+   allocates from it (is_hilight, /RECV through irc_inline) keeps that
+   memory until the next batch is read. */
+typedef struct arena arena;
+arena *arena_new (gsize size);
+gpointer arena_alloc (arena *a, gsize size);
+char *arena_strndup (arena *a, const char *str, gsize len);
+void arena_reset (arena *a);
+void arena_free (arena *a);
 #endif
@@ -1014,7 +1014,35 @@ private:
 class ChatDisplay : public Fl_Text_Display
 {
 public:
-	ChatDisplay (int X, int Y, int W, int H) : Fl_Text_Display (X, Y, W, H) {}
+	ChatDisplay (int X, int Y, int W, int H, session *s) : Fl_Text_Display (X, Y, W, H), sess (s) {}
+
+	~ChatDisplay ()
+	{
+		Fl::remove_timeout (load_older_cb, this);
+	}
+
+	// After /clear, don't bring the old scrollback back in
+	void forget_history () { history_done = true; }
+
+	// A replay is starting: page older lines in again, and start with
+	// a couple of screenfuls so there's something to scroll through
+	int replay_start ()
+	{
+		history_done = false;
+		return std::max (mNVisibleLines * 2, 50);
+	}
+
+	// Replay only brought in the newest page; fetch older scrollback
+	// whenever the top line comes into view, after the redraw is done.
+	void draw () override
+	{
+		Fl_Text_Display::draw ();
+		if (mTopLineNum == 1 && !history_done && !load_pending)
+		{
+			load_pending = true;
+			Fl::add_timeout (0.0, load_older_cb, this);
+		}
+	}
 
 	int handle (int ev) override
 	{
@@ -1040,6 +1068,31 @@ public:
 	}
 
 private:
+	session *sess;
+	bool history_done {false};
+	bool load_pending {false};
+
+	static void load_older_cb (void *data)
+	{
+		ChatDisplay *self = static_cast<ChatDisplay *> (data);
+		self->load_pending = false;
+		if (!is_session (self->sess) || !self->buffer ())
+			return;
+
+		int before = self->buffer ()->length ();
+		int top = self->mTopLineNum;
+		if (scrollback_load_older (self->sess, std::max (self->mNVisibleLines, 1)) == 0)
+		{
+			// nothing older left, stop asking on every redraw
+			self->history_done = true;
+			return;
+		}
+
+		// keep the lines that were on screen where they were
+		int added = self->buffer ()->length () - before;
+		self->scroll (top + self->count_lines (0, added, true), 0);
+	}
+
 	void open_url_at (int pos, bool copy_only)
 	{
 		Fl_Text_Buffer *buf = buffer ();
@@ -1685,7 +1738,7 @@ ensure_session_ui (session *sess)
 
 	int text_w = content_w - 190;
 	int text_h = content_h - 40;
-	Fl_Text_Display *display = new ChatDisplay (content_x, content_y + 26, text_w, text_h);
+	Fl_Text_Display *display = new ChatDisplay (content_x, content_y + 26, text_w, text_h, sess);
 	display->wrap_mode (Fl_Text_Display::WRAP_AT_BOUNDS, 0);
 	Fl_Text_Buffer *buffer = new Fl_Text_Buffer ();
 	display->buffer (buffer);
@@ -1747,8 +1800,10 @@ ensure_session_ui (session *sess)
 	return &inserted.first->second;
 }
 
+// Formats one line of text into the session's buffer, at the end or,
+// for scrollback paged in from above, at the top.
 static void
-append_text (session *sess, const char *text)
+insert_text (session *sess, const char *text, time_t stamp, bool at_top)
 {
 	SessionUI *ui = ensure_session_ui (sess ? sess : current_tab);
 	if (!ui || !ui->buffer)
@@ -1762,15 +1817,14 @@ append_text (session *sess, const char *text)
 	// Timestamp
 	if (prefs.hex_stamp_text)
 	{
-		char tbuf[64];
-		time_t now = time (NULL);
-		struct tm *tm = localtime (&now);
+		int len;
 		const char *fmt = prefs.hex_stamp_text_format[0] ? prefs.hex_stamp_text_format : "%H:%M:%S";
-		if (tm && strftime (tbuf, sizeof tbuf, fmt, tm))
+		const char *str = get_stamp_cached (fmt, stamp ? stamp : time (NULL), &len);
+		if (len)
 		{
-			out += tbuf;
+			out.append (str, len);
 			out += " ";
-			styles.append (strlen (tbuf) + 1, 'A');
+			styles.append (len + 1, 'A');
 		}
 	}
 
@@ -1919,6 +1973,14 @@ append_text (session *sess, const char *text)
 		styles.push_back ('A');
 	}
 
+	if (at_top)
+	{
+		if (ui->style_buffer && ui->style_buffer->length () == ui->buffer->length ())
+			ui->style_buffer->insert (0, styles.c_str ());
+		ui->buffer->insert (0, out.c_str ());
+		return;
+	}
+
 	ui->buffer->append (out.c_str ());
 	if (ui->style_buffer && ui->style_buffer->length () <= ui->buffer->length ())
 		ui->style_buffer->append (styles.c_str ());
@@ -1936,6 +1998,12 @@ append_text (session *sess, const char *text)
 	}
 }
 
+static void
+append_text (session *sess, const char *text)
+{
+	insert_text (sess, text, 0, false);
+}
+
 static void
 update_tab_title (session *sess)
 {
@@ -4959,6 +5027,8 @@ fe_text_clear (struct session *sess, int lines)
 	SessionUI *ui = ensure_session_ui (sess);
 	if (ui && ui->buffer)
 		ui->buffer->text ("");
+	if (ui && ui->display)
+		static_cast<ChatDisplay *> (ui->display)->forget_history ();
 }
 
 void
@@ -5006,8 +5076,23 @@ fe_progressbar_end (struct server *serv)
 void
 fe_print_text (struct session *sess, char *text, time_t stamp, gboolean no_activity)
 {
-	(void)stamp; (void)no_activity;
-	append_text (sess, text);
+	(void)no_activity;
+	insert_text (sess, text, stamp, false);
+}
+
+int
+fe_replay_start (struct session *sess)
+{
+	SessionUI *ui = ensure_session_ui (sess);
+	if (!ui || !ui->display)
+		return 0;
+	return static_cast<ChatDisplay *> (ui->display)->replay_start ();
+}
+
+void
+fe_prepend_text (struct session *sess, char *text, time_t stamp)
+{
+	insert_text (sess, text, stamp, true);
 }
 
 void
@@ -5019,7 +5104,7 @@ fe_userlist_insert (struct session *sess, struct User *newuser, gboolean sel)
 	SessionUI *ui = ensure_session_ui (sess);
 	if (!ui)
 		return;
-	std::string nick (newuser->nick);
+	std::string nick (newuser->person->nick);
 	std::string label;
 	if (newuser->prefix[0])
 		label += newuser->prefix;
@@ -5037,7 +5122,7 @@ fe_userlist_remove (struct session *sess, struct User *user)
 	SessionUI *ui = ensure_session_ui (sess);
 	if (!ui)
 		return 0;
-	ui->users.erase (user->nick);
+	ui->users.erase (user->person->nick);
 	ui->userlist_dirty = true;
 	schedule_userlist_refresh ();
 	return 1;
@@ -5103,6 +5188,32 @@ fe_userlist_clear (struct session *sess)
 	schedule_userlist_refresh ();
 }
 
+static int
+userlist_reload_cb (const void *key, void *data)
+{
+	const struct User *user = static_cast<const struct User *>(key);
+	SessionUI *ui = static_cast<SessionUI *>(data);
+	std::string nick (user->person->nick);
+	std::string label;
+	if (user->prefix[0])
+		label += user->prefix;
+	label += nick;
+	ui->users[nick] = label;
+	return TRUE;
+}
+
+void
+fe_userlist_reload (struct session *sess)
+{
+	SessionUI *ui = ensure_session_ui (sess);
+	if (!ui)
+		return;
+	ui->users.clear ();
+	userlist_foreach (sess, userlist_reload_cb, ui);
+	ui->userlist_dirty = true;
+	schedule_userlist_refresh ();
+}
+
 void
 fe_userlist_set_selected (struct session *sess)
 {
@@ -5400,7 +5511,7 @@ fe_set_throttle (server *serv)
 	if (!throttle_indicator)
 		return;
 
-	if (serv && serv->outbound_queue)
+	if (serv && tcp_send_queue_lines (serv))
 	{
 		throttle_indicator->value (1);
 		throttle_indicator->copy_label ("");
@@ -41,6 +41,7 @@
 #include "../common/outbound.h"
 #include "../common/util.h"
 #include "../common/fe.h"
+#include "../common/text.h"
 #include "fe-text.h"
 
 
@@ -111,24 +112,36 @@ fe_new_window (struct session *sess, int focus)
 	fflush (stdout);
 }
 
-static int
-get_stamp_str (time_t tim, char *dest, int size)
-{
-	return strftime_validated (dest, size, prefs.hex_stamp_text_format, localtime (&tim));
-}
-
 static int
 timecat (char *buf, time_t stamp)
 {
-	char stampbuf[64];
+	const char *stampbuf;
+	int len;
 
 	/* set the stamp to the current time if not provided */
 	if (!stamp)
 		stamp = time (0);
 
-	get_stamp_str (stamp, stampbuf, sizeof (stampbuf));
-	strcat (buf, stampbuf);
-	return strlen (stampbuf);
+	stampbuf = get_stamp_cached (prefs.hex_stamp_text_format, stamp, &len);
+	memcpy (buf, stampbuf, len + 1);
+	return len;
+}
+
+/* room for a stamp at the start of the text and after every newline */
+static int
+timecat_room (const char *text, int len, time_t stamp)
+{
+	const char *p;
+	int stamp_len, lines = 1;
+
+	if (!prefs.hex_stamp_text)
+		return 0;
+
+	get_stamp_cached (prefs.hex_stamp_text_format, stamp ? stamp : time (0), &stamp_len);
+	for (p = text; (p = memchr (p, '\n', text + len - p)); p++)
+		lines++;
+
+	return lines * (stamp_len + 1);
 }
 
 /* Windows doesn't handle ANSI codes in cmd.exe, need to not display them */
@@ -144,12 +157,12 @@ fe_print_text (struct session *sess, char *text, time_t stamp,
 	char num[8];
 	int reverse = 0, under = 0, bold = 0,
 		comma, k, i = 0, j = 0, len = strlen (text);
-	unsigned char *newtext = g_malloc (len + 1024);
+	unsigned char *newtext = g_malloc (len + 1024 + timecat_room (text, len, stamp));
 
 	if (prefs.hex_stamp_text)
 	{
 		newtext[0] = 0;
-		j += timecat (newtext, stamp);
+		j += timecat ((char *) newtext + j, stamp);
 	}
 	while (i < len)
 	{
@@ -157,7 +170,7 @@ fe_print_text (struct session *sess, char *text, time_t stamp,
 		{
 			dotime = FALSE;
 			newtext[j] = 0;
-			j += timecat (newtext, stamp);
+			j += timecat ((char *) newtext + j, stamp);
 		}
 		switch (text[i])
 		{
@@ -312,12 +325,12 @@ fe_print_text (struct session *sess, char *text, time_t stamp,
 	int dotime = FALSE;
 	int comma, k, i = 0, j = 0, len = strlen (text);
 
-	unsigned char *newtext = g_malloc (len + 1024);
+	unsigned char *newtext = g_malloc (len + 1024 + timecat_room (text, len, stamp));
 
 	if (prefs.hex_stamp_text)
 	{
 		newtext[0] = 0;
-		j += timecat (newtext, stamp);
+		j += timecat ((char *) newtext + j, stamp);
 	}
 	while (i < len)
 	{
@@ -325,7 +338,7 @@ fe_print_text (struct session *sess, char *text, time_t stamp,
 		{
 			dotime = FALSE;
 			newtext[j] = 0;
-			j += timecat (newtext, stamp);
+			j += timecat ((char *) newtext + j, stamp);
 		}
 		switch (text[i])
 		{
@@ -645,6 +658,16 @@ void
 fe_text_clear (struct session *sess, int lines)
 {
 }
+int
+fe_replay_start (struct session *sess)
+{
+	/* a terminal can't insert above what it has printed, so replay it all */
+	return 0;
+}
+void
+fe_prepend_text (struct session *sess, char *text, time_t stamp)
+{
+}
 void
 fe_progressbar_start (struct session *sess)
 {
@@ -675,6 +698,10 @@ fe_userlist_clear (struct session *sess)
 {
 }
 void
+fe_userlist_reload (struct session *sess)
+{
+}
+void
 fe_userlist_set_selected (struct session *sess)
 {
 }